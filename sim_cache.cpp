@@ -15,9 +15,25 @@ simcache.cpp
 #include <vector>
 #include <fstream>
 #include <iomanip>
-#include <regex>
 #include <cstdlib>
 #include <unordered_map>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <array>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
@@ -28,10 +44,11 @@ size_t const static REG_SIZE = 1<<16;
 
 
 /*printing functions*/
-void print_cache_config(const string &cache_name, int size, int assoc, int blocksize, int num_rows) {
+void print_cache_config(const string &cache_name, int size, int assoc, int blocksize, int num_rows,
+                        const string &options = "") {
     cout << "Cache " << cache_name << " has size " << size <<
         ", associativity " << assoc << ", blocksize " << blocksize <<
-        ", rows " << num_rows << endl;
+        ", rows " << num_rows << options << endl;
 }
 
 void print_log_entry(const string &cache_name, const string &status, int pc, int addr, int row) {
@@ -41,6 +58,55 @@ void print_log_entry(const string &cache_name, const string &status, int pc, int
         "\trow:" << setw(4) << row << endl;
 }
 
+/*how accessCache reports each access: through cout as above (flushing every line),
+through a LogBuffer in the same format, or not at all (--stats)*/
+enum LogMode { LOG_COUT, LOG_BUFFERED, LOG_NONE };
+
+/*log lines formatted into one preallocated buffer and written to out in large chunks*/
+struct LogBuffer {
+    vector<char> data = vector<char>(1 << 16);
+    size_t used = 0;
+    ostream *out = &cout;
+
+    void flush() {
+        out->write(data.data(), used);
+        used = 0;
+    }
+};
+
+// writes v right aligned in width columns (wider values are not truncated, like setw)
+inline char *appendPadded(char *p, int v, int width) {
+    char digits[12];
+    int n = 0;
+    unsigned u = v < 0 ? -(unsigned)v : v;
+    do { digits[n++] = '0' + u % 10; u /= 10; } while (u);
+    if (v < 0) digits[n++] = '-';
+    for (int i = n; i < width; i++) *p++ = ' ';
+    while (n) *p++ = digits[--n];
+    return p;
+}
+
+inline char *appendText(char *p, const char *s, size_t len) {
+    memcpy(p, s, len);
+    return p + len;
+}
+
+void buffer_log_entry(LogBuffer &buf, const string &cache_name, const char *status, int pc, int addr, int row) {
+    if (buf.data.size() - buf.used < 128 + cache_name.size())
+        buf.flush();
+    // same layout as print_log_entry: name and status left aligned in 8 columns
+    char *start = buf.data.data() + buf.used, *p = start;
+    p = appendText(p, cache_name.data(), cache_name.size());
+    *p++ = ' ';
+    p = appendText(p, status, strlen(status));
+    while (p - start < 8) *p++ = ' ';
+    p = appendPadded(appendText(p, " pc:", 4), pc, 5);
+    p = appendPadded(appendText(p, "\taddr:", 6), addr, 5);
+    p = appendPadded(appendText(p, "\trow:", 5), row, 4);
+    *p++ = '\n';
+    buf.used += p - start;
+}
+
 /*cache calculations*/
 int getIndex(int address, int BLOCK_SIZE, int ROWS ) {
     return (address / BLOCK_SIZE) % ROWS;
@@ -53,178 +119,1128 @@ int getRow(int Lsize, int Lblocksize, int Lassoc) {
     return (Lsize / (Lblocksize * Lassoc));
 }
 
-/*function that takes the address, decides if hit or miss, then prints the cache output*/
-bool accessCache(int address, int pc, int BLOCK_SIZE, int ROWS, int ASSOC, int CACHE_SIZE, std::unordered_map<int, int>& cache, std::list<int>& lruQueue, std::string Cache_name, uint16_t opcode) {
-    int tag = getTag(address, BLOCK_SIZE, ROWS);
-    int index = getIndex(address, BLOCK_SIZE, ROWS);
+/*why a level can't be built from these numbers, or nullptr if it can*/
+const char *geometryError(int Lsize, int Lassoc, int Lblocksize) {
+    if (Lsize <= 0 || Lassoc <= 0 || Lblocksize <= 0)
+        return "size, associativity and blocksize must be positive";
+    if (Lsize > (int)MEM_SIZE || Lassoc > (int)MEM_SIZE || Lblocksize > (int)MEM_SIZE)
+        return "size, associativity and blocksize must be at most the 8192 words of memory";
+    if (Lassoc > Lsize || Lblocksize > Lsize || getRow(Lsize, Lblocksize, Lassoc) == 0)
+        return "size is smaller than associativity times blocksize";
+    return nullptr;
+}
 
-    // assume tag not found and initialize cache index to outside cache range
-    bool found = false;
-    /*insertIndex is a variable that is used to keep track of the index of the block in the cache 
-    where a new tag needs to be inserted or where an existing tag is found during the cache lookup operation*/
-    int insertIndex = -1;
+// log2 of x if it is a power of two, otherwise -1; 2^30 is the largest power an int holds
+int log2Exact(int x) {
+    int shift = 0;
+    while (shift < 30 && (1 << shift) < x)
+        shift++;
+    return (1 << shift) == x ? shift : -1;
+}
 
+/*replacement policies a level can use, named on the --cache line after the level's
+numbers. POLICY_LEGACY is the original scheme and the default: a full row evicts the
+globally least recently used slot if it lives in that row, otherwise the row's first slot*/
+enum ReplPolicy { POLICY_LEGACY, POLICY_LRU, POLICY_FIFO, POLICY_RANDOM, POLICY_PLRU, POLICY_SRRIP, NUM_POLICIES };
 
-    /*this code implements the cache lookup for a direct-mapped cache by checking if the required tag matches the current index of the cache. 
-    If it is found, then the insertIndex is set to the current index. 
-    If not found, then the insertIndex is still set to the current index,
-     as there is only one possible location where a block can be stored in a direct-mapped cache*/
-if (ASSOC == 1) {
-    // direct-mapped cache
-    if (cache[index] == tag) {
-        found = true;
-        insertIndex = index;
+static const char *const policyNames[NUM_POLICIES] = {"legacy", "lru", "fifo", "random", "plru", "srrip"};
+
+bool parsePolicy(const string &name, ReplPolicy &policy) {
+    for (int p = 0; p < NUM_POLICIES; p++)
+        if (name == policyNames[p]) {
+            policy = (ReplPolicy)p;
+            return true;
+        }
+    return false;
+}
+
+/*hardware prefetchers a level can have, named on the --cache line like the policy*/
+enum Prefetcher { PREFETCH_NONE, PREFETCH_NEXTLINE, PREFETCH_STRIDE, PREFETCH_STREAM, NUM_PREFETCHERS };
+
+static const char *const prefetcherNames[NUM_PREFETCHERS] = {"none", "nextline", "stride", "stream"};
+
+/*how a level relates to the levels above it. NINE (non-inclusive non-exclusive) is
+the original model: fills pass through every level and evictions are independent.
+An inclusive level back-invalidates the levels above when it evicts a block; an
+exclusive level holds only blocks the level above has evicted, handing a block up
+(and dropping it) when the level above asks for it*/
+enum Inclusion { INCL_NINE, INCL_INCLUSIVE, INCL_EXCLUSIVE, NUM_INCLUSIONS };
+
+static const char *const inclusionNames[NUM_INCLUSIONS] = {"nine", "incl", "excl"};
+
+/*everything the --cache line can say about a level besides its geometry. The
+defaults, write-through with write-allocate, are how the original model treats sw*/
+struct LevelOptions {
+    ReplPolicy policy = POLICY_LEGACY;
+    bool writeBack = false;
+    bool writeAllocate = true;
+    Prefetcher prefetcher = PREFETCH_NONE;
+    Inclusion inclusion = INCL_NINE;
+};
+
+/*what a lookup did: the row of the address, the slot that hit or was filled (-1 if
+a miss did not allocate), and the address of the block it evicted (-1 if none) and
+whether that block was dirty*/
+struct Lookup {
+    int row, slot, evicted;
+    bool dirty;
+};
+
+/*prefetcher state. A stride entry is the reference prediction table row of one pc:
+the last address it accessed, the stride seen and a 0..3 confidence. A stream entry
+follows one run of consecutive blocks: the last block used, the direction (0 until
+the second block) and the furthest block already prefetched*/
+struct StrideEntry {
+    int pc = -1, last = 0, stride = 0, confidence = 0;
+};
+
+struct StreamEntry {
+    int last = -1, dir = 0, ahead = 0;
+    uint64_t used = 0;
+};
+
+size_t const static STRIDE_ENTRIES = 64;
+size_t const static STREAM_ENTRIES = 8;
+int const static STREAM_DEPTH = 4;          // blocks a confirmed stream runs ahead
+// --timing's default latencies in cycles: L1, L2, L3 (deeper levels take the last), and memory
+uint64_t const static DEFAULT_LEVEL_CYCLES[] = {1, 10, 40};
+uint64_t const static DEFAULT_MEM_CYCLES = 100;
+
+/*--profile: the lw/sw requests one level saw, and how many missed. A level keeps
+one per pc, per range of PROFILE_RANGE data addresses and per row, in flat arrays
+indexed directly, so counting is a few adds per request*/
+struct ProfileCount {
+    uint64_t loads = 0, loadMisses = 0, stores = 0, storeMisses = 0;
+};
+
+size_t const static PROFILE_RANGE = 64;
+size_t const static PROFILE_TOP = 10; // entries per table for a bare --profile
+
+struct CacheLevel;
+typedef bool (*LookupFn)(CacheLevel &c, int address, bool allocate, Lookup &r);
+
+/*a cache level stored as flat arrays: row r owns slots [r*assoc, r*assoc+assoc).
+tags/valid are indexed by slot, so a lookup only touches the ASSOC slots of one row.
+lruPrev/lruNext thread every slot that has been used through one recency list
+(oldest at lruHead), which reproduces the eviction order of the original
+std::list queue with O(1) updates instead of a linear remove().
+The other policies keep their state in stamp (per slot), rrpv (per slot) or
+plruBits (per row); lookup is the lookupCacheT instance for the policy and geometry*/
+struct CacheLevel {
+    string name;
+    int size = 0, assoc = 0, blocksize = 0, rows = 0;
+    // when blocksize and rows are powers of two: block = address >> blockShift,
+    // row = block & rowMask, tag = block >> rowShift
+    bool pow2 = false;
+    int blockShift = 0, rowShift = 0, rowMask = 0;
+    ReplPolicy policy = POLICY_LEGACY;
+    LookupFn lookup = nullptr;
+    bool writeBack = false, writeAllocate = true;
+    Inclusion inclusion = INCL_NINE;
+    vector<int> tags;
+    vector<uint8_t> valid; // 2 for a dirty block, only ever set in a write-back level
+    vector<int> lruPrev, lruNext;
+    int lruHead = -1, lruTail = -1;
+    vector<uint64_t> stamp;    // lru: last use, fifo: fill time
+    vector<uint8_t> rrpv;      // srrip: re-reference prediction value, 0..3
+    vector<uint64_t> plruBits; // plru: the assoc-1 tree bits of each row
+    uint64_t clock = 0, rng = 0;
+
+    LogMode logMode = LOG_COUT;
+    LogBuffer *logBuf = nullptr; // shared by every level when logMode is LOG_BUFFERED
+
+    // counters kept for every run, printed by print_cache_stats
+    uint64_t hits = 0, misses = 0, sws = 0, evictions = 0;
+    vector<uint64_t> rowEvictions; // evictions in each row, i.e. conflicts on that set
+    // traffic with the level below (memory for the last level), in address units
+    uint64_t bytesIn = 0, bytesOut = 0, writebacks = 0;
+    uint64_t requestsBelow = 0; // fills and stores sent below, i.e. everything but write-backs
+    // inclusive: blocks removed from the levels above, and how many were dirty;
+    // exclusive: victims of the level above inserted here
+    uint64_t backInvalidations = 0, dirtyInvalidations = 0, victimsIn = 0;
+
+    /*prefetching, when prefetcher is set. pfTime holds, per slot, 1 + the demand
+    clock (demandClock) at which its prefetch fill completes, until the block is first
+    used (0 for every other block); latency and memLatency are the --timing cycles of
+    this level and of memory that the clock and the fills are modelled with. pfVictims marks, per block of memory, blocks a prefetch
+    evicted that have not been brought back since. shadow is the same level without
+    the prefetcher, fed the same demand accesses, for the miss reduction*/
+    Prefetcher prefetcher = PREFETCH_NONE;
+    vector<uint64_t> pfTime;
+    uint64_t latency = 0, memLatency = 0;
+    vector<uint8_t> pfVictims;
+    vector<StrideEntry> strideTable;
+    vector<StreamEntry> streams;
+    uint64_t streamClock = 0;
+    unique_ptr<CacheLevel> shadow;
+    uint64_t pfIssued = 0, pfUseful = 0, pfLate = 0, pfUnused = 0, pfPolluting = 0, shadowMisses = 0;
+
+    // --profile counters, sized while profiling is set; initializecache keeps it set
+    bool profiling = false;
+    vector<ProfileCount> pcProfile, rangeProfile, rowProfile;
+
+    /*--3c, while classifying is set (initializecache keeps it): seenBlocks marks every
+    block of memory ever filled here (2 once invalidated from here), and faPrev/faNext
+    thread the blocks of a fully associative LRU cache of the same capacity through
+    one recency list indexed by block (-2 for a block it does not hold), so both are
+    O(1) per request. A lw miss is compulsory if the block was never here, an
+    invalidation miss if an inclusive level or another core removed it, capacity if
+    the fully associative cache misses it too, and conflict otherwise*/
+    bool classifying = false;
+    vector<uint8_t> seenBlocks;
+    vector<int> faPrev, faNext;
+    int faHead = -1, faTail = -1, faBlocks = 0;
+    uint64_t compulsory = 0, capacity = 0, conflict = 0, invalidationMisses = 0;
+};
+
+// move slot to the most recently used end of the recency list
+inline void touchSlot(CacheLevel &c, int slot) {
+    if (c.lruTail == slot)
+        return;
+    if (c.lruPrev[slot] != -2) {
+        // unlink
+        int p = c.lruPrev[slot], n = c.lruNext[slot];
+        if (p == -1) c.lruHead = n; else c.lruNext[p] = n;
+        c.lruPrev[n] = p; // n exists since slot is not the tail
+    }
+    c.lruPrev[slot] = c.lruTail;
+    c.lruNext[slot] = -1;
+    if (c.lruTail == -1) c.lruHead = slot; else c.lruNext[c.lruTail] = slot;
+    c.lruTail = slot;
+}
+
+/*each policy supplies the hooks of lookupCacheT: lastEmpty picks which empty slot a
+miss fills, hit and fill update the policy state, victim chooses the slot to evict
+from a full row*/
+struct LegacyPolicy {
+    static const bool lastEmpty = true;
+    static void hit(CacheLevel &c, int, int slot) { touchSlot(c, slot); }
+    static void fill(CacheLevel &c, int, int slot) { touchSlot(c, slot); }
+    static int victim(CacheLevel &c, int rowStart) {
+        int front = c.lruHead;
+        return front >= rowStart && front < rowStart + c.assoc ? front : rowStart;
+    }
+};
+
+// oldest stamp in the row
+inline int oldestSlot(const CacheLevel &c, int rowStart) {
+    int v = rowStart;
+    for (int i = rowStart + 1; i < rowStart + c.assoc; i++)
+        if (c.stamp[i] < c.stamp[v])
+            v = i;
+    return v;
+}
+
+struct LruPolicy {
+    static const bool lastEmpty = false;
+    static void hit(CacheLevel &c, int, int slot) { c.stamp[slot] = ++c.clock; }
+    static void fill(CacheLevel &c, int, int slot) { c.stamp[slot] = ++c.clock; }
+    static int victim(CacheLevel &c, int rowStart) { return oldestSlot(c, rowStart); }
+};
+
+struct FifoPolicy {
+    static const bool lastEmpty = false;
+    static void hit(CacheLevel &, int, int) {}
+    static void fill(CacheLevel &c, int, int slot) { c.stamp[slot] = ++c.clock; }
+    static int victim(CacheLevel &c, int rowStart) { return oldestSlot(c, rowStart); }
+};
+
+// xorshift64 seeded in initializecache, so runs are repeatable
+struct RandomPolicy {
+    static const bool lastEmpty = false;
+    static void hit(CacheLevel &, int, int) {}
+    static void fill(CacheLevel &, int, int) {}
+    static int victim(CacheLevel &c, int rowStart) {
+        c.rng ^= c.rng << 13;
+        c.rng ^= c.rng >> 7;
+        c.rng ^= c.rng << 17;
+        return rowStart + (int)(c.rng % (uint64_t)c.assoc);
+    }
+};
+
+/*tree pseudo-LRU: node n (1-based, children 2n and 2n+1) holds bit n of the row's
+word, 0 meaning the pseudo-LRU way is in the left half. Needs a power of two assoc*/
+struct PlruPolicy {
+    static const bool lastEmpty = false;
+    static void touch(CacheLevel &c, int row, int way) {
+        uint64_t &bits = c.plruBits[row];
+        int node = 1;
+        for (int half = c.assoc >> 1; half > 0; half >>= 1) {
+            int right = (way & half) != 0;
+            // point the node away from the way just used
+            if (right) bits &= ~(1ull << node); else bits |= 1ull << node;
+            node = 2 * node + right;
+        }
+    }
+    static void hit(CacheLevel &c, int row, int slot) { touch(c, row, slot - row * c.assoc); }
+    static void fill(CacheLevel &c, int row, int slot) { touch(c, row, slot - row * c.assoc); }
+    static int victim(CacheLevel &c, int rowStart) {
+        uint64_t bits = c.plruBits[rowStart / c.assoc];
+        int node = 1, way = 0;
+        for (int half = c.assoc >> 1; half > 0; half >>= 1) {
+            int right = (bits >> node) & 1;
+            way |= right ? half : 0;
+            node = 2 * node + right;
+        }
+        return rowStart + way;
+    }
+};
+
+/*static RRIP with 2-bit values: fills are predicted distant (2), hits near (0), and
+the victim is the first slot predicted furthest (3), ageing the row until one is*/
+struct SrripPolicy {
+    static const bool lastEmpty = false;
+    static void hit(CacheLevel &c, int, int slot) { c.rrpv[slot] = 0; }
+    static void fill(CacheLevel &c, int, int slot) { c.rrpv[slot] = 2; }
+    static int victim(CacheLevel &c, int rowStart) {
+        int v = rowStart;
+        for (int i = rowStart + 1; i < rowStart + c.assoc; i++)
+            if (c.rrpv[i] > c.rrpv[v])
+                v = i;
+        uint8_t age = 3 - c.rrpv[v];
+        if (age)
+            for (int i = rowStart; i < rowStart + c.assoc; i++)
+                c.rrpv[i] += age;
+        return v;
+    }
+};
+
+/*looks the address up in one cache level and, on a miss with allocate set, installs
+its block; returns true on a hit. Instantiated for each policy, for shift/mask or
+division address splitting (Pow2) and for a fixed associativity (Assoc, 0 when it
+is only known at run time), so the row scan and the policy updates are inlined
+together and the common geometries get a fully unrolled scan*/
+template <class Policy, bool Pow2, int Assoc>
+bool lookupCacheT(CacheLevel &c, int address, bool allocate, Lookup &r) {
+    int tag, index;
+    if (Pow2) {
+        int block = address >> c.blockShift;
+        index = block & c.rowMask;
+        tag = block >> c.rowShift;
     } else {
-        insertIndex = index;
+        tag = getTag(address, c.blocksize, c.rows);
+        index = getIndex(address, c.blocksize, c.rows);
     }
-} else {
-    /*The code starts by checking if the tag is already in the set-associative cache.
-     If it is, the code updates the LRU queue to move the block to the back of the queue.If the tag is not in the cache, the code checks if the cache is full.
-      If it is, the code evicts the LRU block in the row where the tag would be stored. 
-      The code then inserts the new tag into the cache and moves it to the back of the LRU queue.If there are no empty blocks in the row,
-       the code evicts the LRU block in the row and inserts the new tag into the evicted block. 
-       The code then moves the new tag to the back of the LRU queue */
-  
-    int rowStartIndex = index * ASSOC;
-    int rowEndIndex = rowStartIndex + ASSOC - 1;
-    int emptyBlocks = 0;
-    int lruIndex = -1;
-
-    for (int i = rowStartIndex; i <= rowEndIndex; i++) {
-        if (cache[i] == -1) {
-            //if cache cell is empty, increment number of empty cells, then tag is inserteed in the empty cell
-            emptyBlocks++;
-            insertIndex = i;
-        } else if (cache[i] == tag) {
-            //if cache  has tag, then the insert tag holds index where tag is found
-            found = true;
-            insertIndex = i;
-            lruIndex = i; //update recently used index 
-            break;
-        } else if (lruIndex == -1 || lruQueue.front() == i) { 
-            lruIndex = i;
-        } /*The code first checks if lruIndex is -1. This means that the cache is empty and there is no LRU block. In this case, the code sets lruIndex to the index of the new tag.
-
-If lruIndex is not -1, the code checks if the front of the LRU queue is the same as the index of the new tag. 
-This means that the new tag is the most recently used block.
- In this case, the code sets lruIndex to the index of the new tag.*/
-    }
-
-    if (!found && insertIndex == -1) {
-        // if the cache is full and the tag is not found, evict the LRU block in the row
-        int evictIndex = lruQueue.front();
-        if (evictIndex >= rowStartIndex && evictIndex <= rowEndIndex) {
-            // LRU block is in the same row
-            cache[evictIndex] = -1;
-            insertIndex = evictIndex;
-        } else if (emptyBlocks > 0) {
-            // LRU block is in a different row and there are empty blocks in this row
-            insertIndex = rowStartIndex + emptyBlocks - 1;
-        } else {
-            // LRU block is in a different row and there are no empty blocks in this row
-            cache[lruIndex] = -1;
-            insertIndex = lruIndex;
+    const int assoc = Assoc ? Assoc : c.assoc;
+    int rowStart = index * assoc;
+    int insertIndex = -1;
+    r.row = index;
+    r.evicted = -1;
+    r.dirty = false;
+
+    /*scan the row: a matching tag is a hit, otherwise remember an empty slot.
+    For a direct-mapped cache the row is a single slot*/
+    for (int i = rowStart; i < rowStart + assoc; i++) {
+        if (!c.valid[i]) {
+            if (Policy::lastEmpty || insertIndex == -1)
+                insertIndex = i;
+        } else if (c.tags[i] == tag) {
+            Policy::hit(c, index, i);
+            r.slot = i;
+            return true;
         }
     }
+
+    if (!allocate) {
+        r.slot = -1;
+        return false;
+    }
+    if (insertIndex == -1) {
+        insertIndex = Policy::victim(c, rowStart);
+        c.evictions++;
+        c.rowEvictions[index]++;
+        r.evicted = (c.tags[insertIndex] * c.rows + index) * c.blocksize;
+        r.dirty = c.valid[insertIndex] == 2;
+    }
+
+    c.tags[insertIndex] = tag;
+    c.valid[insertIndex] = 1;
+    Policy::fill(c, index, insertIndex);
+    r.slot = insertIndex;
+    return false;
+}
+
+// the kernel for a policy: fixed associativity 1, 2, 4 or 8, otherwise a run-time loop
+template <class Policy, bool Pow2>
+LookupFn geometryLookup(int assoc) {
+    switch (assoc) {
+    case 1: return lookupCacheT<Policy, Pow2, 1>;
+    case 2: return lookupCacheT<Policy, Pow2, 2>;
+    case 4: return lookupCacheT<Policy, Pow2, 4>;
+    case 8: return lookupCacheT<Policy, Pow2, 8>;
+    default: return lookupCacheT<Policy, Pow2, 0>;
+    }
 }
 
-// insert new tag in cache
+template <class Policy>
+LookupFn policyLookup(bool pow2, int assoc) {
+    return pow2 ? geometryLookup<Policy, true>(assoc) : geometryLookup<Policy, false>(assoc);
+}
+
+/*chooses the lookup kernel once, when the level is configured*/
+LookupFn selectLookup(ReplPolicy policy, bool pow2, int assoc) {
+    switch (policy) {
+    case POLICY_LRU: return policyLookup<LruPolicy>(pow2, assoc);
+    case POLICY_FIFO: return policyLookup<FifoPolicy>(pow2, assoc);
+    case POLICY_RANDOM: return policyLookup<RandomPolicy>(pow2, assoc);
+    case POLICY_PLRU: return policyLookup<PlruPolicy>(pow2, assoc);
+    case POLICY_SRRIP: return policyLookup<SrripPolicy>(pow2, assoc);
+    default: return policyLookup<LegacyPolicy>(pow2, assoc);
+    }
+}
 
-cache[insertIndex] = tag;
+// the options shown in the configuration header; defaults are not shown
+string levelLabel(const LevelOptions &o) {
+    string label;
+    if (o.policy != POLICY_LEGACY)
+        label += string(", policy ") + policyNames[o.policy];
+    if (o.writeBack)
+        label += ", write-back";
+    if (!o.writeAllocate)
+        label += ", no-write-allocate";
+    if (o.prefetcher != PREFETCH_NONE)
+        label += string(", prefetch ") + prefetcherNames[o.prefetcher];
+    if (o.inclusion == INCL_INCLUSIVE)
+        label += ", inclusive";
+    else if (o.inclusion == INCL_EXCLUSIVE)
+        label += ", exclusive";
+    return label;
+}
 
-// move the block to the back of the LRU queue for its row
-lruQueue.remove(insertIndex);
-lruQueue.push_back(insertIndex);
+// plru walks a binary tree of ways held in one 64-bit word per row
+bool policySupports(ReplPolicy policy, int assoc) {
+    return policy != POLICY_PLRU || (assoc > 0 && assoc <= 64 && (assoc & (assoc - 1)) == 0);
+}
 
-if (opcode == 5) {
-    print_log_entry(Cache_name, "SW", pc, address, index);
-    return false;
+/*an exclusive level takes the victims of the level above whole, so the blocks must
+match; an inclusive level must be able to hold any block of the levels above*/
+const char *inclusionError(const vector<int> &parts, const vector<LevelOptions> &options, size_t level) {
+    int blocksize = parts[level * 3 + 2];
+    if (options[level].inclusion == INCL_EXCLUSIVE && blocksize != parts[level * 3 - 1])
+        return "is exclusive, so its blocksize must equal the blocksize of the level above";
+    for (size_t up = 0; up < level && options[level].inclusion == INCL_INCLUSIVE; up++)
+        if (parts[up * 3 + 2] > blocksize)
+            return "is inclusive, so its blocksize must be at least the blocksize of the levels above";
+    return nullptr;
 }
-else if (found) {
-    print_log_entry(Cache_name, "HIT", pc, address, index);
-    return true;
+
+// zeroed --profile counters while profiling, none otherwise
+void sizeProfile(CacheLevel &c) {
+    c.pcProfile.assign(c.profiling ? MEM_SIZE : 0, ProfileCount());
+    c.rangeProfile.assign(c.profiling ? (MEM_SIZE + PROFILE_RANGE - 1) / PROFILE_RANGE : 0, ProfileCount());
+    c.rowProfile.assign(c.profiling ? c.rows : 0, ProfileCount());
+}
+
+// empty --3c state while classifying, none otherwise
+void sizeClassify(CacheLevel &c) {
+    size_t blocks = c.classifying ? MEM_SIZE / c.blocksize + 1 : 0;
+    c.seenBlocks.assign(blocks, 0);
+    c.faPrev.assign(blocks, -2);
+    c.faNext.assign(blocks, -2);
+    c.faHead = c.faTail = -1;
+    c.faBlocks = 0;
+    c.compulsory = c.capacity = c.conflict = c.invalidationMisses = 0;
+}
+
+void initializecache(CacheLevel &c, const string &name, int Lsize, int Lassoc, int Lblocksize,
+                     const LevelOptions &options = LevelOptions()) {
+    ReplPolicy policy = options.policy;
+    c.name = name;
+    c.size = Lsize;
+    c.assoc = Lassoc;
+    c.blocksize = Lblocksize;
+    c.rows = getRow(Lsize, Lblocksize, Lassoc);
+    int blockShift = log2Exact(Lblocksize), rowShift = log2Exact(c.rows);
+    c.pow2 = blockShift >= 0 && rowShift >= 0;
+    c.blockShift = c.pow2 ? blockShift : 0;
+    c.rowShift = c.pow2 ? rowShift : 0;
+    c.rowMask = c.pow2 ? c.rows - 1 : 0;
+    c.policy = policy;
+    c.lookup = selectLookup(policy, c.pow2, Lassoc);
+    c.writeBack = options.writeBack;
+    c.writeAllocate = options.writeAllocate;
+    c.inclusion = options.inclusion;
+    size_t slots = (size_t)c.rows * Lassoc;
+    c.tags.assign(slots, 0);
+    c.valid.assign(slots, 0);
+    c.lruPrev.assign(policy == POLICY_LEGACY ? slots : 0, -2); // -2 marks a slot that has never been used
+    c.lruNext.assign(policy == POLICY_LEGACY ? slots : 0, -2);
+    c.lruHead = c.lruTail = -1;
+    c.stamp.assign(policy == POLICY_LRU || policy == POLICY_FIFO ? slots : 0, 0);
+    c.rrpv.assign(policy == POLICY_SRRIP ? slots : 0, 3);
+    c.plruBits.assign(policy == POLICY_PLRU ? c.rows : 0, 0);
+    c.clock = 0;
+    c.rng = 0x9E3779B97F4A7C15ull;
+    c.hits = c.misses = c.sws = c.evictions = 0;
+    c.rowEvictions.assign(c.rows, 0);
+    c.bytesIn = c.bytesOut = c.writebacks = c.requestsBelow = 0;
+    c.backInvalidations = c.dirtyInvalidations = c.victimsIn = 0;
+    sizeProfile(c);
+    sizeClassify(c);
+
+    c.prefetcher = options.prefetcher;
+    bool prefetching = c.prefetcher != PREFETCH_NONE;
+    c.pfTime.assign(prefetching ? slots : 0, 0);
+    c.pfVictims.assign(prefetching ? MEM_SIZE / Lblocksize + 1 : 0, 0);
+    c.strideTable.assign(c.prefetcher == PREFETCH_STRIDE ? STRIDE_ENTRIES : 0, StrideEntry());
+    c.streams.assign(c.prefetcher == PREFETCH_STREAM ? STREAM_ENTRIES : 0, StreamEntry());
+    c.streamClock = 0;
+    c.pfIssued = c.pfUseful = c.pfLate = c.pfUnused = c.pfPolluting = c.shadowMisses = 0;
+    c.shadow.reset();
+    if (prefetching) {
+        LevelOptions plain = options;
+        plain.prefetcher = PREFETCH_NONE;
+        c.shadow.reset(new CacheLevel());
+        initializecache(*c.shadow, name, Lsize, Lassoc, Lblocksize, plain);
+    }
+}
+
+/*looks the address up with the level's policy and installs its block; returns true
+on a hit. index receives the row of the address*/
+inline bool lookupCache(CacheLevel &c, int address, int &index) {
+    Lookup r;
+    bool found = c.lookup(c, address, true, r);
+    index = r.row;
+    return found;
+}
+
+void logAccess(CacheLevel &c, const char *status, int pc, int address, int index) {
+    if (c.logMode == LOG_COUT)
+        print_log_entry(c.name, status, pc, address, index);
+    else if (c.logMode == LOG_BUFFERED)
+        buffer_log_entry(*c.logBuf, c.name, status, pc, address, index);
+}
+
+// the slot holding the block of address, or -1; unlike a lookup it changes nothing
+int findSlot(const CacheLevel &c, int address) {
+    int tag = getTag(address, c.blocksize, c.rows);
+    int rowStart = getIndex(address, c.blocksize, c.rows) * c.assoc;
+    for (int i = rowStart; i < rowStart + c.assoc; i++)
+        if (c.valid[i] && c.tags[i] == tag)
+            return i;
+    return -1;
+}
+
+inline bool holdsBlock(const CacheLevel &c, int address) {
+    return findSlot(c, address) >= 0;
+}
+
+/*what a level is asked to do: a load (a lw, or the fill of a block for the level
+above), a store of one word (a sw, or a write-through from above), the write-back
+of a dirty block from above, a prefetch (from this level's prefetcher or one above),
+or keeping a clean block the level above evicted (only sent to an exclusive level)*/
+enum Request { REQ_LOAD, REQ_STORE, REQ_WRITEBACK, REQ_PREFETCH, REQ_VICTIM };
+
+void passDown(CacheLevel *const *levels, int depth, int level, Request req, int address, int pc,
+              int bytes, bool found, const Lookup &r);
+void prefetchAfter(CacheLevel *const *levels, int depth, int level, Request req, int address, int pc,
+                   bool found, const Lookup &r);
+void handUp(CacheLevel *const *levels, int depth, int level, int address, int pc, const Lookup &r);
+void evictBlock(CacheLevel *const *levels, int depth, int level, int address, bool dirty, int pc);
+
+inline void countProfile(ProfileCount &p, bool store, bool miss) {
+    if (store) {
+        p.stores++;
+        p.storeMisses += miss;
+    } else {
+        p.loads++;
+        p.loadMisses += miss;
+    }
+}
+
+// unlinks block from the fully associative recency list
+inline void faUnlink(CacheLevel &c, int block) {
+    int p = c.faPrev[block], n = c.faNext[block];
+    if (p == -1) c.faHead = n; else c.faNext[p] = n;
+    if (n == -1) c.faTail = p; else c.faPrev[n] = p;
+    c.faPrev[block] = c.faNext[block] = -2;
+}
+
+// takes block out of the fully associative cache when the level loses it other than by eviction
+inline void faDrop(CacheLevel &c, int block) {
+    if (c.faPrev[block] != -2) {
+        faUnlink(c, block);
+        c.faBlocks--;
+    }
+}
+
+/*a prefetching level's shadow, the level without its prefetcher, sees every request
+the level does (write-backs, victims and prefetches from above included) and
+allocates whenever the level would; its lw misses are the baseline for the miss
+reduction. The level's own prefetches never reach it*/
+inline void feedShadow(CacheLevel &c, Request req, int address, bool allocate) {
+    CacheLevel &shadow = *c.shadow;
+    Lookup sr;
+    if (!shadow.lookup(shadow, address, allocate, sr) && req == REQ_LOAD)
+        c.shadowMisses++;
+}
+
+// the shadow loses a block whenever the level does other than by eviction: handed up or invalidated
+inline void shadowDrop(CacheLevel &c, int address) {
+    int slot = findSlot(*c.shadow, address);
+    if (slot >= 0)
+        c.shadow->valid[slot] = 0;
+}
+
+/*--3c: classifies a lw miss at c against the state before this request, then
+updates both: a request that brings its block into c marks it seen, and the
+fully associative cache uses a block it holds or, if allocate, fills it over its
+least recently used one*/
+void classifyAccess(CacheLevel &c, int address, bool allocate, bool loadMiss) {
+    int block = address / c.blocksize;
+    bool held = c.faPrev[block] != -2;
+    if (loadMiss) {
+        if (!c.seenBlocks[block])
+            c.compulsory++;
+        else if (c.seenBlocks[block] == 2)
+            c.invalidationMisses++;
+        else if (!held)
+            c.capacity++;
+        else
+            c.conflict++;
+    }
+    if (!held && !allocate)
+        return;
+    if (allocate)
+        c.seenBlocks[block] = 1;
+    if (held) {
+        faUnlink(c, block);
+    } else if (c.faBlocks == c.rows * c.assoc) {
+        faUnlink(c, c.faHead);
+    } else {
+        c.faBlocks++;
+    }
+    c.faPrev[block] = c.faTail;
+    c.faNext[block] = -1;
+    if (c.faTail == -1) c.faHead = block; else c.faNext[c.faTail] = block;
+    c.faTail = block;
+}
+
+/*function that takes the address, decides if hit or miss, then prints the cache output.
+The request is made to levels[level] of a hierarchy of depth levels; the fills,
+write-throughs and write-backs it causes go on to the next level, or past the last
+one to memory, where they are only counted. bytes is the size of the data written*/
+inline void accessCache(CacheLevel *const *levels, int depth, int level, Request req, int address, int pc,
+                        int bytes = 1) {
+    CacheLevel &c = *levels[level];
+    Lookup r;
+    bool allocate;
+    if (c.inclusion == INCL_EXCLUSIVE) // only victims from above are kept, not writes passed through it
+        allocate = req == REQ_VICTIM || (req == REQ_WRITEBACK && !holdsBlock(*levels[level - 1], address));
+    else
+        allocate = req == REQ_LOAD || req == REQ_PREFETCH || c.writeAllocate;
+    bool found = c.lookup(c, address, allocate, r);
+    if (c.shadow)
+        feedShadow(c, req, address, allocate);
+    if (c.classifying)
+        classifyAccess(c, address, allocate, req == REQ_LOAD && !found);
+    if (c.profiling && (req == REQ_LOAD || req == REQ_STORE)) {
+        countProfile(c.pcProfile[pc % MEM_SIZE], req == REQ_STORE, !found);
+        countProfile(c.rangeProfile[address / PROFILE_RANGE], req == REQ_STORE, !found);
+        countProfile(c.rowProfile[r.row], req == REQ_STORE, !found);
+    }
+    if (req == REQ_STORE) {
+        c.sws++;
+        logAccess(c, "SW", pc, address, r.row);
+    }
+    else if (req == REQ_WRITEBACK) {
+        logAccess(c, "WB", pc, address, r.row);
+    }
+    else if (req == REQ_PREFETCH) {
+        logAccess(c, "PF", pc, address, r.row);
+    }
+    else if (req == REQ_VICTIM) {
+        logAccess(c, "VIC", pc, address, r.row);
+    }
+    else if (found) {
+        c.hits++;
+        logAccess(c, "HIT", pc, address, r.row);
+        if (c.prefetcher)
+            prefetchAfter(levels, depth, level, req, address, pc, found, r);
+        if (c.inclusion == INCL_EXCLUSIVE)
+            handUp(levels, depth, level, address, pc, r);
+        return; // nothing moves on a load hit
+    }
+    else {
+        c.misses++;
+        logAccess(c, "MISS", pc, address, r.row);
+    }
+    passDown(levels, depth, level, req, address, pc, bytes, found, r);
+    if (c.prefetcher)
+        prefetchAfter(levels, depth, level, req, address, pc, found, r);
 }
-else {
-    print_log_entry(Cache_name, "MISS", pc, address, index);
+
+// the traffic an access at levels[level] causes below it
+// true if an inclusive or exclusive level is at or below levels[from]
+bool tracksAbove(CacheLevel *const *levels, int depth, int from) {
+    for (int l = from; l < depth; l++)
+        if (levels[l]->inclusion != INCL_NINE)
+            return true;
     return false;
 }
+
+// the first level at or below levels[from] that a write-back may go to: exclusive levels only take victims from directly above
+int writeBackLevel(CacheLevel *const *levels, int depth, int from) {
+    while (from < depth && levels[from]->inclusion == INCL_EXCLUSIVE)
+        from++;
+    return from;
+}
+
+void passDown(CacheLevel *const *levels, int depth, int level, Request req, int address, int pc,
+              int bytes, bool found, const Lookup &r) {
+    CacheLevel &c = *levels[level];
+    bool below = level + 1 < depth;
+    bool filled = !found && r.slot >= 0;
+    if (req == REQ_VICTIM) {
+        // the block came from above, nothing is read
+    } else if (req == REQ_LOAD || req == REQ_PREFETCH) {
+        /*a prefetch is off the critical path, so it is not a request for --timing.
+        A miss in an exclusive level is read through it without being kept*/
+        if (filled || (!found && c.inclusion == INCL_EXCLUSIVE)) {
+            c.bytesIn += c.blocksize;
+            c.requestsBelow += req == REQ_LOAD;
+            if (below)
+                accessCache(levels, depth, level + 1, req, address, pc);
+        }
+    } else if (c.writeBack && r.slot >= 0) {
+        /*the write stops here; a block it only partly covers is read from below first,
+        and so is any block when a level below has to know what is above it*/
+        c.valid[r.slot] = 2;
+        if (filled && (bytes < c.blocksize || tracksAbove(levels, depth, level + 1))) {
+            c.bytesIn += c.blocksize;
+            c.requestsBelow++;
+            if (below)
+                accessCache(levels, depth, level + 1, REQ_LOAD, address, pc);
+        }
+    } else {
+        /*write-through, or a miss that does not allocate: the data goes on down.
+        An allocated block is filled by the same request*/
+        if (filled && bytes < c.blocksize)
+            c.bytesIn += c.blocksize;
+        c.bytesOut += bytes;
+        c.requestsBelow += req == REQ_STORE;
+        if (below)
+            accessCache(levels, depth, level + 1, req, address, pc, bytes);
+    }
+
+    // a block the level above has taken must not stay here too, nor in an exclusive level below
+    if (c.inclusion == INCL_EXCLUSIVE && req != REQ_VICTIM && r.slot >= 0 && holdsBlock(*levels[level - 1], address))
+        handUp(levels, depth, level, address, pc, r);
+    if (filled && below && levels[level + 1]->inclusion == INCL_EXCLUSIVE) {
+        Lookup next = r;
+        next.slot = findSlot(*levels[level + 1], address);
+        if (next.slot >= 0)
+            handUp(levels, depth, level + 1, address, pc, next);
+    }
+    if (r.evicted >= 0)
+        evictBlock(levels, depth, level, r.evicted, r.dirty, pc);
+}
+
+/*removes the block of address from c, if it is there, as a back-invalidation.
+Returns what the copy was: 0 if there was none, 1 clean, 2 dirty, in which case
+its data goes to the level that invalidated it*/
+int invalidateBlock(CacheLevel &c, int address, int pc) {
+    int tag = getTag(address, c.blocksize, c.rows);
+    int row = getIndex(address, c.blocksize, c.rows);
+    for (int i = row * c.assoc; i < (row + 1) * c.assoc; i++) {
+        if (c.valid[i] && c.tags[i] == tag) {
+            int state = c.valid[i];
+            c.valid[i] = 0;
+            if (!c.pfTime.empty() && c.pfTime[i]) {
+                c.pfUnused++;
+                c.pfTime[i] = 0;
+            }
+            logAccess(c, "INV", pc, address - address % c.blocksize, row);
+            if (c.shadow)
+                shadowDrop(c, address);
+            // --3c: the fully associative cache loses the block too, and its next miss is not the level's doing
+            int block = address / c.blocksize;
+            if (c.classifying) {
+                faDrop(c, block);
+                c.seenBlocks[block] = 2;
+            }
+            if (state == 2) {
+                c.writebacks++;
+                c.bytesOut += c.blocksize;
+            }
+            return state;
+        }
+    }
+    return 0;
+}
+
+/*what happens to the block at address when levels[level] evicts it: an inclusive
+level first removes every copy above it (a dirty copy makes the block dirty), then
+the block goes to the next level if that level is exclusive, and otherwise only a
+dirty block is written back*/
+void evictBlock(CacheLevel *const *levels, int depth, int level, int address, bool dirty, int pc) {
+    CacheLevel &c = *levels[level];
+    bool below = level + 1 < depth;
+    if (c.inclusion == INCL_INCLUSIVE) {
+        for (int up = 0; up < level; up++) {
+            CacheLevel &u = *levels[up];
+            // every block of the level above that overlaps the evicted one
+            for (int a = address - address % u.blocksize; a < address + c.blocksize; a += u.blocksize) {
+                int state = invalidateBlock(u, a, pc);
+                if (!state)
+                    continue;
+                c.backInvalidations++;
+                if (state == 2) {
+                    c.dirtyInvalidations++;
+                    dirty = true;
+                }
+            }
+        }
+    }
+    /*an inclusive level further down may have evicted the block while it was on its
+    way out of this one, and then an exclusive level must not take it*/
+    bool keep = below && levels[level + 1]->inclusion == INCL_EXCLUSIVE;
+    for (int down = level + 2; keep && down < depth; down++)
+        keep = levels[down]->inclusion != INCL_INCLUSIVE || holdsBlock(*levels[down], address);
+    if (keep) {
+        c.bytesOut += c.blocksize;
+        c.writebacks += dirty;
+        levels[level + 1]->victimsIn++;
+        accessCache(levels, depth, level + 1, dirty ? REQ_WRITEBACK : REQ_VICTIM, address, pc, c.blocksize);
+    } else if (dirty) {
+        c.writebacks++;
+        c.bytesOut += c.blocksize;
+        // past exclusive levels, which can't keep it
+        int to = writeBackLevel(levels, depth, level + 1);
+        if (to < depth)
+            accessCache(levels, depth, to, REQ_WRITEBACK, address, pc, c.blocksize);
+    }
+}
+
+/*an exclusive level that hits a request from above hands the block up and drops it.
+A dirty block stays dirty in a write-back level above; a write-through level above
+can't hold it dirty, so it is written back below on the way*/
+void handUp(CacheLevel *const *levels, int depth, int level, int address, int pc, const Lookup &r) {
+    CacheLevel &c = *levels[level];
+    bool dirty = c.valid[r.slot] == 2;
+    c.valid[r.slot] = 0;
+    if (c.shadow)
+        shadowDrop(c, address);
+    // --3c: the block moved up, so the fully associative cache gives it up as well
+    if (c.classifying)
+        faDrop(c, address / c.blocksize);
+    if (!dirty)
+        return;
+    CacheLevel &up = *levels[level - 1];
+    int slot = findSlot(up, address);
+    if (up.writeBack && slot >= 0) {
+        up.valid[slot] = 2;
+        return;
+    }
+    c.writebacks++;
+    c.bytesOut += c.blocksize;
+    int to = writeBackLevel(levels, depth, level + 1);
+    if (to < depth)
+        accessCache(levels, depth, to, REQ_WRITEBACK, address - address % c.blocksize, pc, c.blocksize);
+}
+
+/*the modelled time, in --timing cycles, the hierarchy has spent on demand lw/sw:
+every level's accesses times its latency, and the requests that reached memory. It
+leaves out the execute cycles, so it runs slower than the --timing total*/
+uint64_t demandClock(CacheLevel *const *levels, int depth) {
+    uint64_t clock = 0;
+    for (int l = 0; l < depth; l++)
+        clock += (levels[l]->hits + levels[l]->misses + levels[l]->sws) * levels[l]->latency;
+    return clock + levels[depth - 1]->requestsBelow * levels[depth - 1]->memLatency;
+}
+
+/*bookkeeping for a block filled into a prefetching level: the block it replaced is
+counted if it was prefetched and never used, and if the fill is a prefetch (ready is
+1 + when it completes, 0 for a demand fill) the replaced block is remembered so a
+later demand miss on it counts as pollution*/
+void notePrefetchFill(CacheLevel &c, const Lookup &r, int address, uint64_t ready) {
+    bool prefetch = ready != 0;
+    if (c.pfTime[r.slot])
+        c.pfUnused++;
+    c.pfTime[r.slot] = ready;
+    if (prefetch && r.evicted >= 0)
+        c.pfVictims[r.evicted / c.blocksize] = 1;
+    c.pfVictims[address / c.blocksize] = 0;
+}
+
+// brings the block of address into levels[level] ahead of demand, unless it is there already
+void issuePrefetch(CacheLevel *const *levels, int depth, int level, int address, int pc) {
+    CacheLevel &c = *levels[level];
+    if (address < 0 || address >= (int)MEM_SIZE || holdsBlock(c, address))
+        return;
+    // an exclusive level leaves blocks the level above has alone
+    if (c.inclusion == INCL_EXCLUSIVE && holdsBlock(*levels[level - 1], address))
+        return;
+    address -= address % c.blocksize;
+    c.pfIssued++;
+    Lookup r;
+    c.lookup(c, address, true, r);
+    // --3c: a prefetched block has been in the level, and fills the fully associative cache too
+    if (c.classifying)
+        classifyAccess(c, address, true, false);
+    logAccess(c, "PF", pc, address, r.row);
+    // the fill takes the latency of every level it passes through, down to one holding the block or memory
+    uint64_t fill = 0;
+    int from = level + 1;
+    for (; from < depth; from++) {
+        fill += levels[from]->latency;
+        if (holdsBlock(*levels[from], address))
+            break;
+    }
+    if (from == depth)
+        fill += c.memLatency;
+    notePrefetchFill(c, r, address, demandClock(levels, depth) + fill + 1);
+    passDown(levels, depth, level, REQ_PREFETCH, address, pc, c.blocksize, false, r);
 }
 
+/*runs after every request to a level with a prefetcher: scores the prefetches, and
+on demand accesses trains the prefetcher and issues what it predicts. Next-line and stream are triggered by a miss or the first use of a
+prefetched block; stride trains on every access of its pc*/
+void prefetchAfter(CacheLevel *const *levels, int depth, int level, Request req, int address, int pc,
+                   bool found, const Lookup &r) {
+    CacheLevel &c = *levels[level];
+    bool demand = req == REQ_LOAD || req == REQ_STORE;
+    if (!demand) {
+        if (!found && r.slot >= 0)
+            notePrefetchFill(c, r, address, 0);
+        return;
+    }
+    bool trigger = !found;
+    if (found && c.pfTime[r.slot]) {
+        // late if this access reached the level (before its own latency here) ahead of the fill
+        uint64_t arrival = demandClock(levels, depth) - c.latency;
+        c.pfUseful++;
+        if (arrival + 1 < c.pfTime[r.slot])
+            c.pfLate++;
+        c.pfTime[r.slot] = 0;
+        trigger = true;
+    }
+    if (!found) {
+        if (c.pfVictims[address / c.blocksize])
+            c.pfPolluting++;
+        if (r.slot >= 0)
+            notePrefetchFill(c, r, address, 0);
+        else
+            c.pfVictims[address / c.blocksize] = 0;
+    }
+    int block = address / c.blocksize;
+    switch (c.prefetcher) {
+    case PREFETCH_NEXTLINE:
+        if (trigger)
+            issuePrefetch(levels, depth, level, (block + 1) * c.blocksize, pc);
+        break;
+    case PREFETCH_STRIDE: {
+        StrideEntry &e = c.strideTable[pc % STRIDE_ENTRIES];
+        if (e.pc != pc) {
+            e = StrideEntry();
+            e.pc = pc;
+            e.last = address;
+            break;
+        }
+        int stride = address - e.last;
+        if (stride != 0 && stride == e.stride) {
+            e.confidence = min(e.confidence + 1, 3);
+        } else if (stride != 0) {
+            e.confidence = max(e.confidence - 1, 0);
+            if (e.confidence == 0)
+                e.stride = stride;
+        }
+        e.last = address;
+        // far enough ahead to leave the current block when the stride is small
+        if (e.confidence >= 2)
+            issuePrefetch(levels, depth, level, address + e.stride * max(1, c.blocksize / abs(e.stride)), pc);
+        break;
+    }
+    case PREFETCH_STREAM: {
+        if (!trigger)
+            break;
+        StreamEntry *match = nullptr, *oldest = &c.streams[0];
+        for (StreamEntry &e : c.streams) {
+            if (e.last >= 0 && (e.dir ? (block - e.last) * e.dir >= 1 && (block - e.last) * e.dir <= STREAM_DEPTH + 1
+                                      : abs(block - e.last) == 1)) {
+                match = &e;
+                break;
+            }
+            if (e.used < oldest->used)
+                oldest = &e;
+        }
+        if (!match) {
+            *oldest = StreamEntry();
+            oldest->last = oldest->ahead = block;
+            oldest->used = ++c.streamClock;
+            break;
+        }
+        if (!match->dir)
+            match->dir = block - match->last;
+        match->last = block;
+        match->used = ++c.streamClock;
+        for (int k = 1; k <= STREAM_DEPTH; k++) {
+            int target = block + match->dir * k;
+            if ((target - match->ahead) * match->dir > 0)
+                issuePrefetch(levels, depth, level, target * c.blocksize, pc);
+        }
+        match->ahead = block + match->dir * STREAM_DEPTH;
+        break;
+    }
+    default:
+        break;
+    }
+}
 
+/*summary printed at halt in --stats mode. next names the level below, or memory*/
+void print_cache_stats(const CacheLevel &c, const string &next, ostream &out = cout) {
+    uint64_t loads = c.hits + c.misses;
+    out << "Cache " << c.name << " stats: accesses " << loads + c.sws << ", hits " << c.hits <<
+        ", misses " << c.misses << ", sw " << c.sws << ", evictions " << c.evictions <<
+        ", hit rate " << fixed << setprecision(2) << (loads ? 100.0 * c.hits / loads : 0.0) << "%" << endl;
+    out.unsetf(ios::floatfield);
+    out << "Cache " << c.name << " to " << next << ": " << c.bytesIn << " bytes read, " << c.bytesOut <<
+        " bytes written, " << c.writebacks << " write-backs" << endl;
+    if (c.prefetcher) {
+        out << "Cache " << c.name << " prefetch " << prefetcherNames[c.prefetcher] << ": issued " << c.pfIssued <<
+            ", useful " << c.pfUseful << ", late " << c.pfLate << ", unused " << c.pfUnused << ", polluting " <<
+            c.pfPolluting << "; misses " << c.misses << ", " << c.shadowMisses << " without prefetching (reduction " <<
+            fixed << setprecision(2) << (c.shadowMisses ? 100.0 * ((double)c.shadowMisses - c.misses) / c.shadowMisses : 0.0) <<
+            "%)" << endl;
+        out.unsetf(ios::floatfield);
+    }
+    if (c.classifying)
+        out << "Cache " << c.name << " misses: " << c.compulsory << " compulsory, " << c.capacity << " capacity, " <<
+            c.conflict << " conflict, " << c.invalidationMisses << " invalidation" << endl;
+    if (c.inclusion == INCL_INCLUSIVE)
+        out << "Cache " << c.name << " inclusive: " << c.backInvalidations << " back-invalidations, " <<
+            c.dirtyInvalidations << " of them dirty" << endl;
+    else if (c.inclusion == INCL_EXCLUSIVE)
+        out << "Cache " << c.name << " exclusive: " << c.victimsIn << " victims inserted from above" << endl;
+    for (int row = 0; row < c.rows; row++)
+        if (c.rowEvictions[row])
+            out << "  " << c.name << " row " << setw(4) << row << ": " << c.rowEvictions[row] << " conflicts" << endl;
+}
 
-uint16_t signExtend7(bitset<7> x) {
-    uint16_t result = static_cast<uint16_t>(x.to_ulong()); // Convert to uint16_t
-    if (x[6] == 1) { // If the 7th bit is 1, sign extend
+uint16_t signExtend7(uint16_t x) {
+    uint16_t result = x & 127;
+    if (result & 64) { // If the 7th bit is 1, sign extend
         result |= 0xFF80;
     }
     return result;
 }
 
-uint16_t signExtend13(bitset<13> x) {
-    if (x[12] == 1) { // Check if 13th bit is 1
-        x |= (0xFFFF << 13); // Set bits 13-15 to 1 (sign extension)
+/*the operations an instruction word can perform once opcode 0 is split by imm4.
+Writes to $0 and unknown opcode 0 functions decode to OP_NOP; a jump to its own
+address decodes to OP_HALT*/
+enum Op : uint8_t {
+    OP_ADD, OP_SUB, OP_OR, OP_AND, OP_SLT, OP_JR, OP_NOP,
+    OP_ADDI, OP_J, OP_HALT, OP_JAL, OP_LW, OP_SW, OP_JEQ, OP_SLTI,
+    NUM_OPS
+};
+
+/*an instruction word with its fields already extracted, so the interpreter loop
+never decodes memory[pc] itself*/
+struct Instr {
+    uint8_t opcode;   // bits 15-13
+    uint8_t op;       // Op used by the threaded engine
+    uint8_t imm4;     // bits 3-0, selects the opcode 0 operation
+    uint8_t RgSrcA;   // bits 12-10
+    uint8_t RgSrcB;   // bits 9-7
+    uint8_t RgDst;    // bits 6-4
+    uint16_t imm7;    // bits 6-0, sign extended
+    uint16_t imm13;   // bits 12-0, zero extended
+};
+
+// addr is where the word lives, needed to recognise halt (a jump to itself)
+Instr decodeInstr(uint16_t word, uint16_t addr) {
+    Instr in;
+    in.opcode = (word >> 13) & 7;
+    in.imm4 = word & 15;
+    in.RgSrcA = (word >> 10) & 7;
+    in.RgSrcB = (word >> 7) & 7;
+    in.RgDst = (word >> 4) & 7;
+    in.imm7 = signExtend7(word);
+    in.imm13 = word & 8191;
+    switch (in.opcode) {
+    case 0:
+        if (in.imm4 == 8)
+            in.op = OP_JR;
+        else if (in.imm4 > 4 || in.RgDst == 0)
+            in.op = OP_NOP;
+        else
+            in.op = OP_ADD + in.imm4;
+        break;
+    case 1: in.op = in.RgSrcB == 0 ? OP_NOP : OP_ADDI; break;
+    case 2: in.op = in.imm13 == addr ? OP_HALT : OP_J; break;
+    case 3: in.op = OP_JAL; break;
+    case 4: in.op = OP_LW; break;
+    case 5: in.op = OP_SW; break;
+    case 6: in.op = OP_JEQ; break;
+    default: in.op = in.RgSrcB == 0 ? OP_NOP : OP_SLTI; break;
     }
-    return static_cast<uint16_t>(x.to_ulong());
+    return in;
+}
+
+// decode every word of memory once; sw keeps the table current through executeopcode5
+void predecode(const uint16_t memory[], Instr decoded[]) {
+    for (size_t i = 0; i < MEM_SIZE; i++)
+        decoded[i] = decodeInstr(memory[i], i);
 }
 
-uint16_t zeroExtend13(bitset<13> x) {
-    x &= 0x1FFF; // Bitwise AND with 0x1FFF (binary 0001111111111111)
-    return static_cast<uint16_t>(x.to_ulong());
+// address accessed by lw/sw: only the least significant 13 bits, since mem size is max 8191
+inline uint16_t memAddress(const Instr &in, const uint16_t reg[]) {
+    return (in.imm7 + reg[in.RgSrcA]) & 8191;
 }
 
 
 // responsible for executing all opcodes of 0
 // imm4 holds the last 4 bits of the instruction
-void executeopcode0(uint16_t &pc, uint16_t RgSrcA[], uint16_t RgSrcB[], uint16_t RgDst[], uint16_t imm4[], uint16_t (&reg)[8]) {
-     if(imm4[pc&8191]==0){ //add
-        if(RgDst[pc&8191]==0){
+void executeopcode0(uint16_t &pc, const Instr &in, uint16_t (&reg)[8]) {
+     if(in.imm4==0){ //add
+        if(in.RgDst==0){
             reg[0]= 0;
         }else{
-        reg[RgDst[pc&8191]]= (reg[RgSrcA[pc&8191]]+reg[RgSrcB[pc&8191]]);
+        reg[in.RgDst]= (reg[in.RgSrcA]+reg[in.RgSrcB]);
          
         }
            pc=pc+1;
         }
   
-     else if(imm4[pc&8191]==1){ // sub
-        if(RgDst[pc&8191]==0){
+     else if(in.imm4==1){ // sub
+        if(in.RgDst==0){
             reg[0]= 0;
         }else { 
-         reg[RgDst[pc&8191]]= reg[RgSrcA[pc&8191]]-reg[RgSrcB[pc&8191]];
+         reg[in.RgDst]= reg[in.RgSrcA]-reg[in.RgSrcB];
             
         }
            pc=pc+1;
-        }else if(imm4[pc&8191]==2){   // or
+        }else if(in.imm4==2){   // or
   
-        if(RgDst[pc&8191]==0){
+        if(in.RgDst==0){
           reg[0]= 0;
         }else{
 
-          reg[RgDst[pc&8191]]= (reg[RgSrcA[pc&8191]]|reg[RgSrcB[pc&8191]]);
+          reg[in.RgDst]= (reg[in.RgSrcA]|reg[in.RgSrcB]);
 
         }
            pc=pc+1;
-         }else if(imm4[pc&8191]==3){ //and
+         }else if(in.imm4==3){ //and
 
-        if(RgDst[pc&8191]==0){
+        if(in.RgDst==0){
              reg[0]= 0;
         }else {
-          reg[RgDst[pc&8191]]= (reg[RgSrcA[pc&8191]]&reg[RgSrcB[pc&8191]]);
+          reg[in.RgDst]= (reg[in.RgSrcA]&reg[in.RgSrcB]);
         }
            pc=pc+1;
-         }else if(imm4[pc&8191]==4){ // slt
+         }else if(in.imm4==4){ // slt
       
-        if(RgDst[pc&8191]==0){
+        if(in.RgDst==0){
              reg[0]= 0;
         }
         else {
-           reg[RgDst[pc&8191]]= (reg[RgSrcA[pc&8191]]<reg[RgSrcB[pc&8191]]);
+           reg[in.RgDst]= (reg[in.RgSrcA]<reg[in.RgSrcB]);
         }
            pc=pc+1;
         }
-     else if(imm4[pc&8191]==8){ // jr
+     else if(in.imm4==8){ // jr
             //value of pc
-          pc=reg[RgSrcA[pc&8191]];
+          pc=reg[in.RgSrcA];
         
         }
      else{ //if it is not any of the above, then it is a .fill, therefore we must increment coutner
@@ -233,12 +1249,12 @@ void executeopcode0(uint16_t &pc, uint16_t RgSrcA[], uint16_t RgSrcB[], uint16_t
 }
 
 // addi opcode
-void executeopcode1(uint16_t &pc, uint16_t RgSrcA[], uint16_t RgSrcB[], uint16_t RgDst[], bitset<7> imm7[], uint16_t (&reg)[8]) {
-        if(RgSrcB[pc&8191]==0){
+void executeopcode1(uint16_t &pc, const Instr &in, uint16_t (&reg)[8]) {
+        if(in.RgSrcB==0){
             reg[0]= 0;
         }else{
         
-        reg[RgSrcB[pc&8191]]= (reg[RgSrcA[pc&8191]]+ signExtend7( imm7[pc&8191]));
+        reg[in.RgSrcB]= (reg[in.RgSrcA]+ in.imm7);
            
         }
         
@@ -246,54 +1262,55 @@ void executeopcode1(uint16_t &pc, uint16_t RgSrcA[], uint16_t RgSrcB[], uint16_t
 }
 
 //jump and halt 
-void executeopcode2(uint16_t &pc, bool &halt, const bitset<13> imm13[]) {
-    if (zeroExtend13(imm13[pc & 8191]) == (pc&8191)) {
+void executeopcode2(uint16_t &pc, bool &halt, const Instr &in) {
+    if (in.imm13 == (pc&8191)) {
         halt = true; // if the pc is the smae as the immediate then this is a halt 
     }
-    pc = zeroExtend13(imm13[pc & 8191]);
+    pc = in.imm13;
 }
 
 //jal
-void executeopcode3(uint16_t &pc, uint16_t &reg7,  bitset<13> imm13[]) {
+void executeopcode3(uint16_t &pc, uint16_t &reg7, const Instr &in) {
     reg7 = pc + 1; //set the next pc in reg7 
-    pc = zeroExtend13(imm13[pc & 8191]);
+    pc = in.imm13;
 }
 
 //lw
-void executeopcode4(uint16_t &pc, uint16_t (&reg)[8], uint16_t (&memory)[MEM_SIZE], uint16_t RgSrcA[], uint16_t RgSrcB[], bitset<7> imm7[]) {
-    if(RgSrcB[pc & 8191] == 0){
+void executeopcode4(uint16_t &pc, const Instr &in, uint16_t (&reg)[8], uint16_t (&memory)[MEM_SIZE]) {
+    if(in.RgSrcB == 0){
         reg[0] = 0;
     }
     else {
-        //only take the least significant 13 bits of the addition as the index of memory, since mem size is max 8191
-        reg[RgSrcB[pc & 8191]] = memory[(signExtend7(imm7[pc & 8191]) + reg[RgSrcA[pc & 8191]]) & 8191];
+        reg[in.RgSrcB] = memory[memAddress(in, reg)];
     }
     pc = pc + 1;
 }
 // sw
-void executeopcode5(uint16_t &pc, uint16_t (&reg)[8], uint16_t (&memory)[MEM_SIZE], uint16_t RgSrcA[], uint16_t RgSrcB[], bitset<7> imm7[]) {
-//store the value of the register in the memory
-   memory[(reg[RgSrcA[pc&8191]]+signExtend7(imm7[pc&8191]))& 8191]= reg[RgSrcB[pc&8191]];
+void executeopcode5(uint16_t &pc, const Instr &in, uint16_t (&reg)[8], uint16_t (&memory)[MEM_SIZE], Instr decoded[]) {
+//store the value of the register in the memory, and redecode the word in case it is later executed
+   uint16_t addr = memAddress(in, reg);
+   memory[addr]= reg[in.RgSrcB];
+   decoded[addr] = decodeInstr(memory[addr], addr);
          pc=pc+1;
 }
 
 //jeq
- void executeopcode6(uint16_t &pc, uint16_t (&reg)[8], uint16_t (&memory)[MEM_SIZE], uint16_t RgSrcA[], uint16_t RgSrcB[], bitset<7> imm7[]) {
-        if(reg[RgSrcA[pc&8191]] == reg[RgSrcB[pc&8191]]){ // if the values in the registers are equal then jump to pc+imm+1 
-            pc = pc+signExtend7(imm7[pc&8191])+1;
+ void executeopcode6(uint16_t &pc, const Instr &in, uint16_t (&reg)[8]) {
+        if(reg[in.RgSrcA] == reg[in.RgSrcB]){ // if the values in the registers are equal then jump to pc+imm+1 
+            pc = pc+in.imm7+1;
             }
         else {
           pc=pc+1;
         }
  }
  //slti
- void executeopcode7(uint16_t &pc, uint16_t (&reg)[8], uint16_t (&memory)[MEM_SIZE], uint16_t RgSrcA[], uint16_t RgSrcB[], bitset<7> imm7[]) {
+ void executeopcode7(uint16_t &pc, const Instr &in, uint16_t (&reg)[8]) {
 
-        if(RgSrcB[pc&8191]==0){
+        if(in.RgSrcB==0){
            reg[0]= 0;
         }
         else {
-           reg[RgSrcB[pc&8191]]= reg[RgSrcA[pc&8191]] < signExtend7(imm7[pc&8191]);
+           reg[in.RgSrcB]= reg[in.RgSrcA] < in.imm7;
         }
            pc=pc+1;
  }
@@ -306,49 +1323,123 @@ void executeopcode5(uint16_t &pc, uint16_t (&reg)[8], uint16_t (&memory)[MEM_SIZ
     @param regs Final value of all registers
     @param memory Final value of memory
     @param memquantity How many words of memory to dump
+    @param out Where to print it
 */
-void print_state(uint16_t pc, uint16_t regs[], uint16_t memory[], size_t memquantity) {
-    cout << setfill(' ');
-    cout << "Final state:" << endl;
-    cout << "\tpc=" <<setw(5)<< pc << endl;
+void print_state(uint16_t pc, const uint16_t regs[], const uint16_t memory[], size_t memquantity, ostream &out = cout) {
+    out << setfill(' ');
+    out << "Final state:" << endl;
+    out << "\tpc=" <<setw(5)<< pc << endl;
 
     for (size_t reg=0; reg<NUM_REGS; reg++)
-        cout << "\t$" << reg << "="<<setw(5)<<regs[reg]<<endl;
+        out << "\t$" << reg << "="<<setw(5)<<regs[reg]<<endl;
 
-    cout << setfill('0');
+    out << setfill('0');
     bool cr = false;
     for (size_t count=0; count<memquantity; count++) {
-        cout << hex << setw(4) << memory[count] << " ";
+        out << hex << setw(4) << memory[count] << " ";
         cr = true;
         if (count % 8 == 7) {
-            cout << endl;
+            out << endl;
             cr = false;
         }
     }
     if (cr)
-        cout << endl;
+        out << endl;
 }
 
 
-/*reads data and loads it to memory cells*/
-void load_data_from_file( ifstream &f, char *filename, uint16_t memory[], uint16_t &pc ,uint16_t opcode[],uint16_t imm4[],bitset<7> imm7[],  
-bitset<13> imm13[],  uint16_t RgSrcA[],uint16_t RgSrcB[],uint16_t RgDst[]  ){
-    if (!f.is_open()) {
-        cerr << "Can't open file "<<filename<<endl;
-        exit (1);
+/*read-only view of a whole file: mmap on POSIX, one read into memory elsewhere*/
+struct MappedFile {
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+    void *map = nullptr;
+    vector<uint8_t> copy;
+
+    bool open(const char *path) {
+#if defined(__unix__) || defined(__APPLE__)
+        int fd = ::open(path, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        size = st.st_size;
+        if (size > 0) {
+            map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED) {
+                map = nullptr;
+                close(fd);
+                return false;
+            }
+            data = (const uint8_t *)map;
+        }
+        close(fd);
+        return true;
+#else
+        ifstream in(path, ios::binary);
+        if (!in.is_open())
+            return false;
+        in.seekg(0, ios::end);
+        size = in.tellg();
+        in.seekg(0);
+        copy.resize(size);
+        in.read((char *)copy.data(), size);
+        data = copy.data();
+        return true;
+#endif
+    }
+
+    ~MappedFile() {
+#if defined(__unix__) || defined(__APPLE__)
+        if (map)
+            munmap(map, size);
+#endif
     }
+};
 
-    string line;    // define the standard format of the instructions 
-    regex machine_code_re("^ram\\[(\\d+)\\] = 16'b(\\d+);.*$");
+/*raw program images: this 8 byte header, then one little-endian 16 bit word per memory
+cell starting at address 0. --raw loads the words without a header*/
+static const char IMAGE_MAGIC[8] = {'E','2','0','R','A','W','1','\n'};
+
+/*parses the ram[N] = 16'b...; text format in place, accepting exactly the lines the
+original regex ^ram\[(\d+)\] = 16'b(\d+);.*$ did and failing with the same messages.
+Returns the number of words loaded*/
+size_t parse_ram_text(const char *p, const char *end, uint16_t memory[]) {
     size_t expectedaddr = 0;
-    while (getline(f, line)) {
-        smatch sm;
-        if (!regex_match(line, sm, machine_code_re)) {
-            cerr << "Can't parse line: " << line << endl;
+    while (p < end) {
+        const char *eol = (const char *)memchr(p, '\n', end - p);
+        if (!eol)
+            eol = end;
+        const char *q = p;
+        size_t addr = 0;
+        unsigned instr = 0;
+        bool ok = eol - q > 4 && memcmp(q, "ram[", 4) == 0;
+        if (ok) {
+            q += 4;
+            const char *digits = q;
+            while (q < eol && *q >= '0' && *q <= '9')
+                addr = min<size_t>(addr * 10 + (*q++ - '0'), SIZE_MAX / 16);
+            ok = q > digits && eol - q >= 8 && memcmp(q, "] = 16'b", 8) == 0;
+        }
+        if (ok) {
+            q += 8;
+            const char *digits = q;
+            // like stoi(..., 2): the value of the leading binary digits
+            bool binary = true;
+            while (q < eol && *q >= '0' && *q <= '9') {
+                binary &= *q <= '1';
+                if (binary)
+                    instr = (instr << 1) | (*q - '0');
+                q++;
+            }
+            ok = q > digits && *digits <= '1' && q < eol && *q == ';' &&
+                 memchr(q, '\r', eol - q) == nullptr; // . does not match a carriage return
+        }
+        if (!ok) {
+            cerr << "Can't parse line: ";
+            cerr.write(p, eol - p) << endl;
             exit(1);
         }
-        size_t addr = stoi(sm[1], nullptr, 10);
-        unsigned instr = stoi(sm[2], nullptr, 2);
         if (addr != expectedaddr) {
             cerr << "Memory addresses encountered out of sequence: " << addr << endl;
             exit(1);
@@ -360,195 +1451,2835 @@ bitset<13> imm13[],  uint16_t RgSrcA[],uint16_t RgSrcB[],uint16_t RgDst[]  ){
        //set the value of each memory cell as the value of the 16 bit instruction
         memory[addr] = instr;
         expectedaddr ++;
-       }
+        p = eol + 1;
+    }
+    return expectedaddr;
 }
-/*simluate a cache of single level */
-void onelevelcache(uint16_t pc, bitset<7> imm7[], uint16_t RgSrcA[],uint16_t reg[], int L1blocksize, int num_rows_l1, int L1assoc, int L1size, unordered_map<int, int>& cache1, list<int>& lruQueue1, uint16_t opcode[]){
 
-      // Simulate cache
-         bitset<13> calculatedimm= (signExtend7(imm7[pc & 8191]) + reg[RgSrcA[pc & 8191]]) & 8191;
-        int address= calculatedimm.to_ulong();
-       accessCache(address,  pc, L1blocksize, num_rows_l1, L1assoc, L1size, cache1, lruQueue1, "L1",  opcode[pc&8191]);
-    
+size_t load_raw_image(const uint8_t *p, size_t size, uint16_t memory[]) {
+    if (size % 2 != 0) {
+        cerr << "Raw image has an odd number of bytes" << endl;
+        exit(1);
+    }
+    size_t words = size / 2;
+    if (words > MEM_SIZE) {
+        cerr << "Program too big for memory" << endl;
+        exit(1);
+    }
+    for (size_t i = 0; i < words; i++)
+        memory[i] = p[2 * i] | (p[2 * i + 1] << 8);
+    return words;
 }
-/*simluate a cache of two levels */
-void twolevelcache(uint16_t pc, bitset<7> imm7[], uint16_t RgSrcA[],uint16_t reg[], int L1blocksize, int num_rows_l1, int L1assoc, int L1size, unordered_map<int, int>& cache1, list<int>& lruQueue1,int L2blocksize, int num_rows_l2, int L2assoc, int L2size, unordered_map<int, int>& cache2, list<int>& lruQueue2, uint16_t opcode[]){
-  bitset<13> calculatedimm= (signExtend7(imm7[pc & 8191]) + reg[RgSrcA[pc & 8191]]) & 8191;
-                 int address= calculatedimm.to_ulong();
-                 bool foundincache1= accessCache(address, pc, L1blocksize, num_rows_l1, L1assoc, L1size,cache1,lruQueue1, "L1", opcode[pc&8191]);
-             if(!foundincache1){
-                accessCache(address, pc, L2blocksize, num_rows_l2, L2assoc, L2size,cache2,lruQueue2, "L2", opcode[pc&8191]);
-            }   
-} 
-          
-
-void initializecache(std::unordered_map<int, int>& cache, int Lsize, int Lassoc)
-{
-    for (int i = 0; i < Lsize; i++) {
-        for (int j = 0; j < Lassoc; j++) {
-            cache[i * Lassoc + j] = -1;
-        }
+
+/*reads data and loads it to memory cells, then predecodes every word. The file is a
+raw image if it starts with IMAGE_MAGIC or raw is set, otherwise ram[N] = 16'b...; text.
+Returns the number of words loaded*/
+size_t load_data_from_file( const char *filename, uint16_t memory[], Instr decoded[], bool raw ){
+    MappedFile f;
+    if (!f.open(filename)) {
+        cerr << "Can't open file "<<filename<<endl;
+        exit (1);
     }
+    size_t words;
+    if (f.size >= sizeof IMAGE_MAGIC && memcmp(f.data, IMAGE_MAGIC, sizeof IMAGE_MAGIC) == 0)
+        words = load_raw_image(f.data + sizeof IMAGE_MAGIC, f.size - sizeof IMAGE_MAGIC, memory);
+    else if (raw)
+        words = load_raw_image(f.data, f.size, memory);
+    else
+        words = parse_ram_text((const char *)f.data, (const char *)f.data + f.size, memory);
+    predecode(memory, decoded);
+    return words;
 }
 
-void simulatecache(vector<int> parts,string cache_config,uint16_t pc, bitset<7> imm7[], uint16_t RgSrcA[],uint16_t reg[], int L1blocksize, int num_rows_l1, int L1assoc, int L1size, unordered_map<int, int>& cache1, list<int>& lruQueue1,int L2blocksize, int num_rows_l2, int L2assoc, int L2size, unordered_map<int, int>& cache2, list<int>& lruQueue2, uint16_t opcode[])
-{
-         if (cache_config.size() > 0) {
-        if (parts.size() == 3) {
-       onelevelcache(pc,imm7,RgSrcA,reg,L1blocksize,num_rows_l1,L1assoc,L1size,cache1,lruQueue1,opcode);
-        } else if (parts.size() == 6) {
-            twolevelcache(pc,imm7,RgSrcA,reg,L1blocksize,num_rows_l1,L1assoc,L1size,cache1,lruQueue1,L2blocksize,num_rows_l2,L2assoc,L2size,cache2,lruQueue2,opcode);    
-        } else {
-            cerr << "Invalid cache config"  << endl;
-            exit(-1);
-        }
+bool save_raw_image(const char *path, const uint16_t memory[], size_t words) {
+    ofstream out(path, ios::binary);
+    if (!out.is_open())
+        return false;
+    out.write(IMAGE_MAGIC, sizeof IMAGE_MAGIC);
+    for (size_t i = 0; i < words; i++) {
+        char w[2] = {(char)(memory[i] & 255), (char)(memory[i] >> 8)};
+        out.write(w, 2);
     }
+    return (bool)out;
 }
+/*--stack-distance: Mattson's single pass LRU analysis. For a fixed number of rows, an
+access hits in an A-way LRU cache exactly when fewer than A other blocks of its row were
+used since its block was last used (its stack distance). One pass per row count gives
+the hit rate of every associativity, and so of every cache size, for that blocksize.
+Each row counts distances with a Fenwick tree over its access times in which only the
+latest access of every block is marked; when a row runs out of times its live marks
+are renumbered from 0, so the trees stay the size of the row's blocks, not the trace*/
+struct RowStack {
+    vector<int> tree; // Fenwick tree, 1-based
+    int time = 0;
 
+    void add(int i, int v) { for (i++; i < (int)tree.size(); i += i & -i) tree[i] += v; }
+    int prefix(int i) const { int s = 0; for (; i > 0; i -= i & -i) s += tree[i]; return s; } // marks before i
+};
 
-int main(int argc, char *argv[]) {
-     //define the necessary variables and constants 
- char *filename = nullptr;
-    bool do_help = false;
-    bool arg_error = false;
-    string cache_config;
-    unordered_map<int, int> cache1,cache2;
-    list<int> lruQueue,lruQueue1,lruQueue2;      
-    bool halt=false;
-    bitset<13> imm13[MEM_SIZE]={0};
-    uint16_t reg[NUM_REGS]={0}, RgSrcA[MEM_SIZE]={0}, RgSrcB[MEM_SIZE]={0}, RgDst[MEM_SIZE]={0},opcode[MEM_SIZE]={0},imm4[MEM_SIZE]={0},pc=0,memory[MEM_SIZE]={0};
-    bitset<7>  imm7[MEM_SIZE]={0};
-    vector<int> parts;
-    size_t pos;
-    size_t lastpos = 0;
-    int L1size=0,L2size=0,L1assoc=0,L2assoc=0,L1blocksize=0,L2blocksize=0, num_rows_l1=0,num_rows_l2=0;
-      
-    /*get the cache configuration*/
-    for (int i=1; i<argc; i++) {
-        string arg(argv[i]);
-        if (arg.rfind("-",0)==0) {
-            if (arg== "-h" || arg == "--help")
-                do_help = true;
-            else if (arg=="--cache") {
-                i++;
-                if (i>=argc)
-                    arg_error = true;
-                else
-                    cache_config = argv[i];
+/*hist[d] receives the number of loads with stack distance d in a cache of the given
+rows; loads of a block never seen before are counted in cold*/
+void stackDistances(const vector<uint16_t> &accesses, int blocksize, int rows,
+                    vector<uint64_t> &hist, uint64_t &cold) {
+    int blocks = (MEM_SIZE + blocksize - 1) / blocksize;
+    int perRow = (blocks + rows - 1) / rows;
+    vector<RowStack> stacks(rows);
+    for (RowStack &rs : stacks)
+        rs.tree.assign(2 * perRow + 3, 0);
+    vector<int> last(blocks, -1);
+    vector<pair<int, int>> live;
+    hist.assign(blocks + 1, 0);
+    cold = 0;
+    for (uint16_t a : accesses) {
+        int block = (a & 8191) / blocksize;
+        RowStack &rs = stacks[block % rows];
+        if (rs.time + 1 == (int)rs.tree.size()) {
+            // renumber the blocks of this row by last use: 0 .. live-1
+            live.clear();
+            for (int b = block % rows; b < blocks; b += rows)
+                if (last[b] >= 0)
+                    live.push_back({last[b], b});
+            sort(live.begin(), live.end());
+            fill(rs.tree.begin(), rs.tree.end(), 0);
+            for (size_t i = 0; i < live.size(); i++) {
+                last[live[i].second] = i;
+                rs.add(i, 1);
             }
-            else
-                arg_error = true;
+            rs.time = live.size();
+        }
+        bool load = !(a & 0x8000);
+        if (last[block] < 0) {
+            cold += load;
         } else {
-            if (filename == nullptr)
-                filename = argv[i];
-            else
-                arg_error = true;
+            if (load)
+                hist[rs.prefix(rs.time) - rs.prefix(last[block] + 1)]++;
+            rs.add(last[block], -1);
         }
+        rs.add(rs.time, 1);
+        last[block] = rs.time++;
     }
+}
 
-    /* Display error message if appropriate */
-    if (arg_error || do_help || filename == nullptr) {
-        cerr << "usage " << argv[0] << " [-h] [--cache CACHE] filename" << endl << endl; 
-        cerr << "Simulate E20 cache" << endl << endl;
-        cerr << "positional arguments:" << endl;
-        cerr << "  filename    The file containing machine code, typically with .bin suffix" << endl<<endl;
-        cerr << "optional arguments:"<<endl;
-        cerr << "  -h, --help  show this help message and exit"<<endl;
-        cerr << "  --cache CACHE  Cache configuration: size,associativity,blocksize (for one"<<endl;
-        cerr << "                 cache) or"<<endl;
-        cerr << "                 size,associativity,blocksize,size,associativity,blocksize"<<endl;
-        cerr << "                 (for two caches)"<<endl;
-        return 1;
-    }
-/*open file*/
-    ifstream f(filename);
-    if (!f.is_open()) {
-        cerr << "Can't open file "<<filename<<endl;
-        return 1;
+void print_stack_distance(const vector<uint16_t> &accesses, int blocksize) {
+    uint64_t loads = 0;
+    for (uint16_t a : accesses)
+        loads += !(a & 0x8000);
+    int maxBlocks = (MEM_SIZE + blocksize - 1) / blocksize;
+    const int assocs[] = {1, 2, 4, 8, 16, 32};
+    cout << "Stack distance miss ratios (LRU), blocksize " << blocksize << ", " << loads << " loads, "
+         << accesses.size() - loads << " sw" << endl;
+    cout << left << setw(8) << "size" << right;
+    for (int a : assocs)
+        cout << setw(9) << ("assoc " + to_string(a));
+    cout << setw(9) << "full" << endl;
+
+    // hit counts for every (rows, assoc), computed once per power of two row count
+    vector<vector<uint64_t>> hitsByRows;
+    uint64_t cold = 0;
+    for (int rows = 1; rows <= maxBlocks; rows *= 2) {
+        vector<uint64_t> hist;
+        stackDistances(accesses, blocksize, rows, hist, cold);
+        // cumulative: hits[a] = loads with distance < a
+        vector<uint64_t> hits(hist.size() + 1, 0);
+        for (size_t d = 0; d < hist.size(); d++)
+            hits[d + 1] = hits[d] + hist[d];
+        hitsByRows.push_back(hits);
     }
-/*load the machine code from the file */
-load_data_from_file(f,filename,memory,pc,opcode,imm4,imm7,imm13,RgSrcA,RgSrcB,RgDst);
-    
+    auto missRatio = [&](int rows, int assoc) {
+        int k = 0;
+        while ((1 << k) < rows) k++;
+        const vector<uint64_t> &hits = hitsByRows[k];
+        uint64_t h = hits[min((size_t)assoc, hits.size() - 1)];
+        return loads ? 100.0 * (loads - h) / loads : 0.0;
+    };
+    for (int blocksInCache = 1; blocksInCache <= maxBlocks; blocksInCache *= 2) {
+        cout << left << setw(8) << blocksInCache * blocksize << right << fixed << setprecision(2);
+        for (int a : assocs) {
+            if (a > blocksInCache)
+                cout << setw(9) << "-";
+            else
+                cout << setw(9) << missRatio(blocksInCache / a, a);
+        }
+        cout << setw(9) << missRatio(1, blocksInCache) << endl;
+    }
+    cout.unsetf(ios::floatfield);
+}
+
+/*--record-trace/--replay-trace format: an 8 byte magic followed by one 4 byte
+little-endian record per lw/sw: the pc (16 bits), then the address (13 bits) with
+bit 15 set for a sw*/
+static const char TRACE_MAGIC[8] = {'E','2','0','T','R','C','1','\n'};
+
+struct TraceWriter {
+    ofstream out;
+    vector<uint8_t> buf;
+    uint64_t records = 0;
+};
+
+bool openTrace(TraceWriter &tw, const char *path) {
+    tw.out.open(path, ios::binary);
+    if (!tw.out.is_open())
+        return false;
+    tw.out.write(TRACE_MAGIC, sizeof TRACE_MAGIC);
+    tw.buf.reserve(1 << 16);
+    return true;
+}
+
+void flushTrace(TraceWriter &tw) {
+    tw.out.write((const char *)tw.buf.data(), tw.buf.size());
+    tw.buf.clear();
+}
+
+inline void recordTrace(TraceWriter &tw, uint16_t pc, uint16_t address, bool store) {
+    uint16_t a = address | (store ? 0x8000 : 0);
+    tw.buf.push_back(pc & 255);
+    tw.buf.push_back(pc >> 8);
+    tw.buf.push_back(a & 255);
+    tw.buf.push_back(a >> 8);
+    tw.records++;
+    if (tw.buf.size() >= (1 << 16))
+        flushTrace(tw);
+}
+
+/*splits a --cache string into its numbers and the options of each level: the three
+numbers of a level may be followed by a replacement policy name, wt or wb (write-through
+or write-back), wa or nwa (write-allocate or not) and a prefetcher (nextline, stride
+or stream), each at most once. Returns false
+on any other field, or a policy the level can't use*/
+bool parsecacheconfig(const string &config, vector<int> &parts, vector<LevelOptions> &options) {
+    parts.clear();
+    options.clear();
+    size_t start = 0;
+    int seen = 0; // option kinds already given for the current level
+    while (true) {
+        size_t end = config.find(',', start);
+        string field = config.substr(start, end == string::npos ? string::npos : end - start);
+        ReplPolicy policy;
+        if (!field.empty() && (isdigit((unsigned char)field[0]) || field[0] == '-')) {
+            // the whole field must be a number that fits an int; geometryError checks its range
+            char *stop = nullptr;
+            long value = strtol(field.c_str(), &stop, 10);
+            if (stop == field.c_str() || *stop || value != (int)value)
+                return false;
+            parts.push_back((int)value);
+            if (parts.size() % 3 == 0)
+                options.push_back(LevelOptions());
+            seen = 0;
+        } else if (parts.empty() || parts.size() % 3 != 0) {
+            return false;
+        } else if (parsePolicy(field, policy) && !(seen & 1)) {
+            if (!policySupports(policy, parts[parts.size() - 2]))
+                return false;
+            options.back().policy = policy;
+            seen |= 1;
+        } else if ((field == "wt" || field == "wb") && !(seen & 2)) {
+            options.back().writeBack = field == "wb";
+            seen |= 2;
+        } else if ((field == "wa" || field == "nwa") && !(seen & 4)) {
+            options.back().writeAllocate = field == "wa";
+            seen |= 4;
+        } else if ((field == "nextline" || field == "stride" || field == "stream") && !(seen & 8)) {
+            options.back().prefetcher = field == "nextline" ? PREFETCH_NEXTLINE :
+                                        field == "stride" ? PREFETCH_STRIDE : PREFETCH_STREAM;
+            seen |= 8;
+        } else if ((field == "nine" || field == "incl" || field == "excl") && !(seen & 16) && options.size() > 1) {
+            options.back().inclusion = field == "nine" ? INCL_NINE : field == "incl" ? INCL_INCLUSIVE : INCL_EXCLUSIVE;
+            seen |= 16;
+        } else {
+            return false;
+        }
+        if (end == string::npos)
+            break;
+        start = end + 1;
+    }
+    // an inclusive level must keep every block a store brings into the levels above
+    for (const LevelOptions &o : options)
+        if (o.inclusion == INCL_INCLUSIVE && !o.writeAllocate)
+            return false;
+    return true;
+}
+
+/*the cache levels of a --cache configuration, L1 first, with the pointers
+accessCache walks. Any number of levels can be chained*/
+struct Hierarchy {
+    vector<CacheLevel> levels;
+    vector<CacheLevel *> chain;
+};
+
+/*sizes (or empties) one level per three numbers of parts, named L1, L2, ...
+Reusing a hierarchy of the same depth keeps its buffers*/
+void buildHierarchy(Hierarchy &h, const vector<int> &parts, const vector<LevelOptions> &options) {
+    size_t depth = parts.size() / 3;
+    h.levels.resize(depth);
+    h.chain.resize(depth);
+    for (size_t l = 0; l < depth; l++) {
+        initializecache(h.levels[l], "L" + to_string(l + 1), parts[3 * l], parts[3 * l + 1], parts[3 * l + 2], options[l]);
+        h.chain[l] = &h.levels[l];
+        h.levels[l].latency = DEFAULT_LEVEL_CYCLES[min(l, size(DEFAULT_LEVEL_CYCLES) - 1)];
+        h.levels[l].memLatency = DEFAULT_MEM_CYCLES;
+    }
+}
+
+// a lw or sw entering the hierarchy at L1
+inline void hierarchyAccess(Hierarchy &h, int pc, int address, bool store) {
+    accessCache(h.chain.data(), h.chain.size(), 0, store ? REQ_STORE : REQ_LOAD, address, pc);
+}
+
+// where the traffic below a level goes, for the stats
+string belowName(const Hierarchy &h, size_t level) {
+    return level + 1 < h.levels.size() ? h.levels[level + 1].name : "memory";
+}
+
+/*--sweep: many cache configurations simulated side by side against one execution.
+Accesses are queued and every configuration then runs over the whole batch in turn,
+so one configuration's rows stay in the host cache while it is being updated instead
+of all N configurations being touched on every access*/
+struct SweepConfig {
+    string spec;
+    vector<int> parts;
+    vector<LevelOptions> options;
+    Hierarchy caches;
+};
+
+struct SweepSet {
+    vector<SweepConfig> configs;
+    vector<uint32_t> pending; // pc << 16 | store << 15 | address
+};
+
+size_t const static SWEEP_BATCH = 4096;
+
+/*--timing: the cycles each operation takes to execute, the latency of each cache
+level and of memory, and how often each operation ran. An lw or sw also waits for
+every level its request reaches, and for memory when it goes past the last level
+(or when there is no cache). Write-backs are assumed buffered and cost nothing*/
+struct TimingModel {
+    uint64_t opCycles[NUM_OPS];
+    vector<uint64_t> levelCycles = vector<uint64_t>(begin(DEFAULT_LEVEL_CYCLES), end(DEFAULT_LEVEL_CYCLES));
+    uint64_t memCycles = DEFAULT_MEM_CYCLES;
+    uint64_t opCounts[NUM_OPS] = {0};
+    TimingModel() { fill(begin(opCycles), end(opCycles), 1); }
+};
+
+size_t const static MAX_TIMING_LEVEL = 64;
+
+uint64_t levelLatency(const TimingModel &t, size_t level) {
+    return t.levelCycles[min(level, t.levelCycles.size() - 1)];
+}
+
+// the latencies of a --timing SPEC for timing prefetches, in place of the defaults buildHierarchy sets
+void setLatencies(Hierarchy &h, const TimingModel &t) {
+    for (size_t l = 0; l < h.levels.size(); l++) {
+        h.levels[l].latency = levelLatency(t, l);
+        h.levels[l].memLatency = t.memCycles;
+    }
+}
+
+static const char *const opNames[NUM_OPS] = {
+    "add", "sub", "or", "and", "slt", "jr", "nop", "addi", "j", "halt", "jal", "lw", "sw", "jeq", "slti"
+};
+
+/*reads a comma separated list of name=cycles, where name is a level (l1, l2, ...),
+mem or an operation (add, lw, jeq, ...). Returns false on a malformed item*/
+bool parseTiming(const string &spec, TimingModel &t) {
+    size_t start = 0;
+    while (start < spec.size()) {
+        size_t end = spec.find(',', start);
+        string item = spec.substr(start, end == string::npos ? string::npos : end - start);
+        start = end == string::npos ? spec.size() : end + 1;
+        size_t eq = item.find('=');
+        if (eq == string::npos || eq + 1 == item.size() || item.find_first_not_of("0123456789", eq + 1) != string::npos)
+            return false;
+        string name = item.substr(0, eq);
+        uint64_t cycles = stoull(item.substr(eq + 1));
+        if (name.size() > 1 && name[0] == 'l' && name.find_first_not_of("0123456789", 1) == string::npos) {
+            size_t level = stoul(name.substr(1));
+            if (level == 0 || level > MAX_TIMING_LEVEL)
+                return false;
+            if (level > t.levelCycles.size())
+                t.levelCycles.resize(level, t.levelCycles.back());
+            t.levelCycles[level - 1] = cycles;
+        }
+        else if (name == "mem")
+            t.memCycles = cycles;
+        else {
+            int op = 0;
+            while (op < NUM_OPS && name != opNames[op])
+                op++;
+            if (op == NUM_OPS)
+                return false;
+            t.opCycles[op] = cycles;
+        }
+    }
+    return true;
+}
+
+struct MultiCore;
+
+/*the memory side of the simulation: the levels parsed from --cache, the trace
+being recorded and the sweep being run, if any*/
+struct CacheSystem {
+    vector<int> parts;
+    vector<LevelOptions> options; // one per level
+    string cache_config;
+    Hierarchy caches;
+    TraceWriter *trace = nullptr;
+    SweepSet *sweep = nullptr;
+    vector<uint16_t> *capture = nullptr; // address | store << 15 of every access, for --stack-distance
+    TimingModel *timing = nullptr;       // counts operations when set; the engines read it
+    MultiCore *multi = nullptr;          // --cores: the private L1s and coherence; caches then holds the shared levels
+    int core = 0;                        // the core whose lw/sw the engine is running
+};
+
+void runSweepBatch(SweepSet &sw) {
+    for (SweepConfig &sc : sw.configs) {
+        for (uint32_t p : sw.pending)
+            hierarchyAccess(sc.caches, p >> 16, p & 8191, p & 0x8000);
+    }
+    sw.pending.clear();
+}
+
+inline void queueSweep(SweepSet &sw, uint16_t pc, int address, bool store) {
+    sw.pending.push_back((uint32_t)pc << 16 | (store ? 0x8000 : 0) | address);
+    if (sw.pending.size() == SWEEP_BATCH)
+        runSweepBatch(sw);
+}
+
+/*expands one --sweep item: each comma separated field of a --cache string may be a
+colon separated list of values, and every combination becomes a configuration string.
+Returns false on a malformed item*/
+bool expandSweep(const string &item, vector<string> &out) {
+    vector<vector<string>> fields;
+    size_t start = 0;
+    while (true) {
+        size_t end = item.find(',', start);
+        string field = item.substr(start, end == string::npos ? string::npos : end - start);
+        vector<string> values;
+        size_t vs = 0;
+        while (true) {
+            size_t ve = field.find(':', vs);
+            values.push_back(field.substr(vs, ve == string::npos ? string::npos : ve - vs));
+            if (values.back().empty())
+                return false;
+            if (ve == string::npos)
+                break;
+            vs = ve + 1;
+        }
+        fields.push_back(values);
+        if (end == string::npos)
+            break;
+        start = end + 1;
+    }
+    // odometer over the fields
+    vector<size_t> pick(fields.size(), 0);
+    while (true) {
+        string current;
+        for (size_t f = 0; f < fields.size(); f++)
+            current += (f ? "," : "") + fields[f][pick[f]];
+        out.push_back(current);
+        size_t f = fields.size();
+        while (f > 0 && ++pick[f - 1] == fields[f - 1].size())
+            pick[--f] = 0;
+        if (f == 0)
+            break;
+    }
+    return true;
+}
+
+/*builds the sweep from the --sweep arguments, each a ';' separated list of items.
+Combinations too small to hold one row are skipped*/
+bool setupSweep(SweepSet &sw, const vector<string> &specs) {
+    for (const string &spec : specs) {
+        size_t start = 0;
+        while (start <= spec.size()) {
+            size_t end = spec.find(';', start);
+            string item = spec.substr(start, end == string::npos ? string::npos : end - start);
+            start = end == string::npos ? spec.size() + 1 : end + 1;
+            if (item.empty())
+                continue;
+            vector<string> expanded;
+            if (!expandSweep(item, expanded))
+                return false;
+            for (const string &config : expanded) {
+                SweepConfig sc;
+                sc.spec = config;
+                const vector<int> &parts = sc.parts;
+                if (!parsecacheconfig(config, sc.parts, sc.options) || parts.empty())
+                    return false;
+                bool fits = true;
+                for (size_t l = 0; l < parts.size(); l += 3) {
+                    if (parts[l] <= 0 || parts[l + 1] <= 0 || parts[l + 2] <= 0 || parts[l] > (int)MEM_SIZE ||
+                        parts[l + 1] > (int)MEM_SIZE || parts[l + 2] > (int)MEM_SIZE)
+                        return false;
+                    fits &= getRow(parts[l], parts[l + 2], parts[l + 1]) > 0 && !inclusionError(parts, sc.options, l / 3);
+                }
+                if (!fits)
+                    continue;
+                sw.configs.push_back(move(sc));
+                SweepConfig &added = sw.configs.back();
+                buildHierarchy(added.caches, added.parts, added.options);
+                for (CacheLevel &c : added.caches.levels)
+                    c.logMode = LOG_NONE;
+            }
+        }
+    }
+    sw.pending.reserve(SWEEP_BATCH);
+    return !sw.configs.empty();
+}
+
+// one group of columns per level of the deepest configuration, at least L1 and L2
+void print_sweep_table(const SweepSet &sw) {
+    size_t width = 8, depth = 2;
+    for (const SweepConfig &sc : sw.configs) {
+        width = max(width, sc.spec.size() + 2);
+        depth = max(depth, sc.caches.levels.size());
+    }
+    cout << left << setw(width) << "config" << right;
+    for (size_t level = 0; level < depth; level++) {
+        string name = "L" + to_string(level + 1);
+        cout << setw(10) << name + " hits" << setw(10) << name + " miss" << setw(9) << name + " hit%";
+    }
+    cout << setw(11) << "mem bytes" << endl;
+    for (const SweepConfig &sc : sw.configs) {
+        cout << left << setw(width) << sc.spec << right;
+        for (size_t level = 0; level < depth; level++) {
+            if (level >= sc.caches.levels.size()) {
+                cout << setw(10) << "-" << setw(10) << "-" << setw(9) << "-";
+                continue;
+            }
+            const CacheLevel &c = sc.caches.levels[level];
+            uint64_t loads = c.hits + c.misses;
+            cout << setw(10) << c.hits << setw(10) << c.misses << setw(9) << fixed << setprecision(2)
+                 << (loads ? 100.0 * c.hits / loads : 0.0);
+            cout.unsetf(ios::floatfield);
+        }
+        // traffic between the last level and memory
+        const CacheLevel &last = sc.caches.levels.back();
+        cout << setw(11) << last.bytesIn + last.bytesOut << endl;
+    }
+}
+
+
+/*--cores: E20 cores sharing memory and every cache level below L1, each with its own
+pc, registers and a private L1 built from the first level of --cache. The L1s are
+kept coherent by snooping MESI: a block is M when it is dirty in one L1, and E or
+S when it is clean, E if no other L1 holds it. Before an access reaches the
+hierarchy the other L1s are snooped: a load miss (BusRd) makes an M copy write its
+block back and become S, and a store (BusRdX on a miss, BusUpgr on a hit in S)
+invalidates every other copy, an M one after writing it back. A store to an E or
+M block needs no bus request*/
+struct Core {
+    uint16_t pc = 0;
+    uint16_t reg[NUM_REGS] = {0};
+    bool halted = false;
+    uint64_t executed = 0;
+    uint64_t busRd = 0, busRdX = 0, busUpgr = 0;
+    uint64_t invalidated = 0, dirtyInvalidated = 0, flushes = 0; // what the other cores' requests did to this L1
+};
+
+struct MultiCore {
+    vector<Core> cores;
+    vector<CacheLevel> l1;               // one per core, never resized once chains point into it
+    vector<vector<CacheLevel *>> chains; // each core's L1 followed by the shared levels
+    /*per L1 block of memory: the core that last stored to it (-1 before any) and how
+    often a store took the block from another core's L1 that another core had last
+    written, i.e. moved write ownership between caches*/
+    vector<int> lastWriter;
+    vector<uint64_t> pingPongs;
+};
+
+// a lw or sw of core entering its L1, after the snoop of the other L1s
+void coherentAccess(MultiCore &mc, int core, int pc, int address, bool store) {
+    vector<CacheLevel *> &chain = mc.chains[core];
+    int depth = chain.size();
+    CacheLevel &own = *chain[0];
+    bool held = holdsBlock(own, address);
+    int block = address / own.blocksize;
+    if (store || !held) {
+        bool shared = false, invalidated = false;
+        for (size_t j = 0; j < mc.cores.size(); j++) {
+            CacheLevel &other = mc.l1[j];
+            int slot = j == (size_t)core ? -1 : findSlot(other, address);
+            if (slot < 0)
+                continue;
+            shared = true;
+            int base = address - address % other.blocksize;
+            bool dirty = other.valid[slot] == 2;
+            if (store) {
+                invalidateBlock(other, address, pc);
+                mc.cores[j].invalidated++;
+                mc.cores[j].dirtyInvalidated += dirty;
+                invalidated = true;
+            } else if (dirty) {
+                // M to S: the block is written back for the reader to find below
+                other.valid[slot] = 1;
+                other.writebacks++;
+                other.bytesOut += other.blocksize;
+                mc.cores[j].flushes++;
+                logAccess(other, "FLUSH", pc, base, getIndex(base, other.blocksize, other.rows));
+            }
+            if (dirty && depth > 1)
+                accessCache(mc.chains[j].data(), depth, 1, REQ_WRITEBACK, base, pc, other.blocksize);
+        }
+        Core &me = mc.cores[core];
+        if (!store)
+            me.busRd++;
+        else if (!held)
+            me.busRdX++;
+        else if (shared)
+            me.busUpgr++;
+        if (invalidated && mc.lastWriter[block] >= 0 && mc.lastWriter[block] != core)
+            mc.pingPongs[block]++;
+    }
+    if (store)
+        mc.lastWriter[block] = core;
+    accessCache(chain.data(), depth, 0, store ? REQ_STORE : REQ_LOAD, address, pc);
+}
+
+/*address is the memory word accessed by the lw (opcode 4) or sw (opcode 5) at pc*/
+void simulatecache(CacheSystem &cs, uint16_t pc, int address, uint16_t opcode)
+{
+    if (cs.trace)
+        recordTrace(*cs.trace, pc, address, opcode == 5);
+    if (cs.sweep)
+        queueSweep(*cs.sweep, pc, address, opcode == 5);
+    if (cs.capture)
+        cs.capture->push_back(address | (opcode == 5 ? 0x8000 : 0));
+    // each level sees the misses, write-throughs and write-backs of the one above
+    if (cs.multi)
+        coherentAccess(*cs.multi, cs.core, pc, address, opcode == 5);
+    else if (!cs.caches.chain.empty())
+        hierarchyAccess(cs.caches, pc, address, opcode == 5);
+}
+
+/*store the cache configuration in parts, size the levels and print their configuration*/
+void configurecache(CacheSystem &cs, const string &cache_config, bool print = true) {
+    cs.cache_config = cache_config;
            /*if there is a cache configuration provided, then store it in appropriate variables for size, associativity and blocksize. from there calculate the number of rows */
     if (cache_config.size() > 0) {
-        while ((pos = cache_config.find(",", lastpos)) != string::npos) {
-            parts.push_back(stoi(cache_config.substr(lastpos,pos)));
-            lastpos = pos + 1;
-        }
-        parts.push_back(stoi(cache_config.substr(lastpos)));
-        if (parts.size() == 3) {
-            /*cache calculation*/
-             L1size = parts[0];
-             L1assoc = parts[1];
-             L1blocksize = parts[2];
-             num_rows_l1 = getRow( L1size,  L1blocksize,  L1assoc);
-
-            print_cache_config("L1", L1size, L1assoc, L1blocksize, num_rows_l1);
-            // Initialize cache1 to -1
-            initializecache(cache1,L1size,L1assoc);
-        
-        }else if(parts.size() == 6){
-            /*cache calculation*/
-             L1size = parts[0];
-             L1assoc = parts[1];
-             L1blocksize = parts[2];
-             L2size = parts[3];
-             L2assoc = parts[4];
-             L2blocksize = parts[5];
-             num_rows_l1 = getRow( L1size,  L1blocksize,  L1assoc);
-             num_rows_l2 = getRow( L2size,  L2blocksize,  L2assoc);
-            
-            print_cache_config("L1", L1size, L1assoc, L1blocksize, num_rows_l1);
-            print_cache_config("L2", L2size, L2assoc, L2blocksize, num_rows_l2);
-             // Initialize cache1 to -1
-          initializecache(cache1,L1size,L1assoc);
-            // Initialize cache2 to -1
-         initializecache(cache2,L2size,L2assoc);
+        if (!parsecacheconfig(cache_config, cs.parts, cs.options)) {
+            cerr << "Invalid cache config"  << endl;
+            exit(-1);
+        }
+        const vector<int> &parts = cs.parts;
+        const vector<LevelOptions> &options = cs.options;
+        // check the geometry here, once, so lookups never see a zero row count
+        if (parts.empty()) {
+            cerr << "Invalid cache config"  << endl;
+            exit(-1);
+        }
+        for (size_t l = 0; l < parts.size(); l += 3) {
+            const char *error = geometryError(parts[l], parts[l + 1], parts[l + 2]);
+            if (!error)
+                error = inclusionError(parts, options, l / 3);
+            if (error) {
+                cerr << "Invalid cache config: L" << l / 3 + 1 << " " << error << endl;
+                exit(-1);
+            }
+        }
+        // Initialize every level to empty
+        buildHierarchy(cs.caches, parts, options);
+        for (size_t l = 0; l < cs.caches.levels.size() && print; l++) {
+            const CacheLevel &c = cs.caches.levels[l];
+            print_cache_config(c.name, c.size, c.assoc, c.blocksize, c.rows, levelLabel(options[l]));
+        }
+    }
+}
+
+/*--cores: replaces the configured L1 by a private copy for each of mc.cores, named
+C0.L1, C1.L1, ..., each chained to the levels left in cs.caches, which all cores
+share, and prints the configuration. The caller has checked that every level below L1
+is nine and that L1 has no prefetcher, whose fills would bypass the snoop*/
+void setupCores(MultiCore &mc, CacheSystem &cs) {
+    Hierarchy &h = cs.caches;
+    const CacheLevel &first = h.levels[0];
+    size_t cores = mc.cores.size();
+    mc.l1.resize(cores);
+    for (size_t i = 0; i < cores; i++) {
+        initializecache(mc.l1[i], "C" + to_string(i) + ".L1", first.size, first.assoc, first.blocksize, cs.options[0]);
+        mc.l1[i].logMode = first.logMode;
+        mc.l1[i].logBuf = first.logBuf;
+    }
+    size_t blocks = MEM_SIZE / first.blocksize + 1;
+    mc.lastWriter.assign(blocks, -1);
+    mc.pingPongs.assign(blocks, 0);
+    h.levels.erase(h.levels.begin());
+    h.chain.clear();
+    for (CacheLevel &c : h.levels)
+        h.chain.push_back(&c);
+    mc.chains.assign(cores, vector<CacheLevel *>());
+    for (size_t i = 0; i < cores; i++) {
+        mc.chains[i].push_back(&mc.l1[i]);
+        mc.chains[i].insert(mc.chains[i].end(), h.chain.begin(), h.chain.end());
+    }
+    cs.multi = &mc;
+    for (const CacheLevel &c : mc.l1)
+        print_cache_config(c.name, c.size, c.assoc, c.blocksize, c.rows, levelLabel(cs.options[0]));
+    for (size_t l = 0; l < h.levels.size(); l++) {
+        const CacheLevel &c = h.levels[l];
+        print_cache_config(c.name, c.size, c.assoc, c.blocksize, c.rows, levelLabel(cs.options[l + 1]) + ", shared");
+    }
+}
+
+void setlogmode(CacheSystem &cs, LogMode mode, LogBuffer *buf) {
+    for (CacheLevel &c : cs.caches.levels) {
+        c.logMode = mode;
+        c.logBuf = buf;
+    }
+}
+
+void print_all_cache_stats(const CacheSystem &cs, ostream &out = cout) {
+    for (size_t l = 0; l < cs.caches.levels.size(); l++)
+        print_cache_stats(cs.caches.levels[l], belowName(cs.caches, l), out);
+}
+
+/*--cores report: what each core ran, its L1 hit rate and the coherence traffic it
+caused and suffered, then the totals and the blocks with the most ping-pongs*/
+void print_cores(const MultiCore &mc, ostream &out = cout) {
+    uint64_t invalidations = 0, dirty = 0, flushes = 0, pingPongs = 0;
+    for (size_t i = 0; i < mc.cores.size(); i++) {
+        const Core &c = mc.cores[i];
+        const CacheLevel &l1 = mc.l1[i];
+        uint64_t loads = l1.hits + l1.misses;
+        out << "Core " << i << ": " << c.executed << " instructions, " << l1.name << " hit rate " << fixed
+            << setprecision(2) << (loads ? 100.0 * l1.hits / loads : 0.0) << "%, BusRd " << c.busRd << ", BusRdX "
+            << c.busRdX << ", BusUpgr " << c.busUpgr << "; invalidated " << c.invalidated << " times ("
+            << c.dirtyInvalidated << " dirty), " << c.flushes << " flushes" << endl;
+        out.unsetf(ios::floatfield);
+        invalidations += c.invalidated;
+        dirty += c.dirtyInvalidated;
+        flushes += c.flushes;
+    }
+    vector<size_t> blocks;
+    for (size_t b = 0; b < mc.pingPongs.size(); b++) {
+        pingPongs += mc.pingPongs[b];
+        if (mc.pingPongs[b])
+            blocks.push_back(b);
+    }
+    out << "Coherence: " << invalidations << " invalidations, " << dirty << " of dirty blocks, " << flushes
+        << " flushes, " << pingPongs << " ping-pongs" << endl;
+    // most ping-pongs first, then lowest address
+    stable_sort(blocks.begin(), blocks.end(), [&](size_t a, size_t b) { return mc.pingPongs[a] > mc.pingPongs[b]; });
+    if (blocks.size() > PROFILE_TOP)
+        blocks.resize(PROFILE_TOP);
+    for (size_t b : blocks)
+        out << "  block " << setw(5) << b * mc.l1[0].blocksize << ": " << mc.pingPongs[b] << " ping-pongs" << endl;
+}
+
+/*--timing report: cycles spent executing and stalled at each level and in memory.
+replayed is the record count of a replayed trace, -1 for a program: a trace holds
+no instructions, so it gets the stalls and AMAT only*/
+void print_timing(const CacheSystem &cs, uint64_t executed, ostream &out = cout, long long replayed = -1) {
+    const TimingModel &t = *cs.timing;
+    uint64_t execute = 0;
+    for (int op = 0; op < NUM_OPS; op++)
+        execute += t.opCounts[op] * t.opCycles[op];
+    const vector<CacheLevel> &level = cs.caches.levels;
+    int levels = level.size();
+    // every lw/sw reaches L1; a replayed trace has no operation counts
+    uint64_t accesses = levels ? level[0].hits + level[0].misses + level[0].sws
+                        : replayed >= 0 ? replayed : t.opCounts[OP_LW] + t.opCounts[OP_SW];
+    uint64_t memRequests = levels ? level[levels - 1].requestsBelow : accesses;
+    vector<uint64_t> stalls(levels + 1);
+    uint64_t stalled = 0;
+    for (int l = 0; l < levels; l++) {
+        const CacheLevel &c = level[l];
+        stalls[l] = (c.hits + c.misses + c.sws) * levelLatency(t, l);
+        stalled += stalls[l];
+    }
+    stalls[levels] = memRequests * t.memCycles;
+    stalled += stalls[levels];
+    uint64_t total = execute + stalled;
+    out << fixed << setprecision(2);
+    if (replayed >= 0) {
+        out << "Timing: " << stalled << " memory cycles for a replayed trace (no instructions, no CPI)" << endl;
+    } else {
+        out << "Timing: " << total << " cycles for " << executed << " instructions, CPI "
+            << (executed ? (double)total / executed : 0.0) << endl;
+        out << "  execute: " << execute << " cycles" << endl;
+    }
+    for (int l = 0; l < levels; l++) {
+        const CacheLevel &c = level[l];
+        out << "  " << c.name << " stalls: " << stalls[l] << " cycles (" << c.hits + c.misses + c.sws
+            << " accesses x " << levelLatency(t, l) << ")" << endl;
+    }
+    out << "  memory stalls: " << stalls[levels] << " cycles (" << memRequests << " accesses x " << t.memCycles << ")" << endl;
+    out << "  AMAT: " << (accesses ? (double)stalled / accesses : 0.0) << " cycles over " << accesses << " lw/sw" << endl;
+    out.unsetf(ios::floatfield);
+}
 
+/*turns on --3c for every level, including the private L1s of --cores*/
+void startClassify(CacheSystem &cs) {
+    for (CacheLevel &c : cs.caches.levels) {
+        c.classifying = true;
+        sizeClassify(c);
+    }
+    for (size_t i = 0; cs.multi && i < cs.multi->l1.size(); i++) {
+        cs.multi->l1[i].classifying = true;
+        sizeClassify(cs.multi->l1[i]);
+    }
+}
+
+/*turns on --profile for every level; counting starts from zero*/
+void startProfile(CacheSystem &cs) {
+    for (CacheLevel &c : cs.caches.levels) {
+        c.profiling = true;
+        sizeProfile(c);
+    }
+}
+
+// indices of the top entries by misses, then by requests, then lowest index first
+vector<size_t> worstEntries(const vector<ProfileCount> &counts, size_t top) {
+    vector<size_t> used;
+    for (size_t i = 0; i < counts.size(); i++)
+        if (counts[i].loads + counts[i].stores)
+            used.push_back(i);
+    auto worse = [&](size_t a, size_t b) {
+        const ProfileCount &x = counts[a], &y = counts[b];
+        uint64_t mx = x.loadMisses + x.storeMisses, my = y.loadMisses + y.storeMisses;
+        if (mx != my)
+            return mx > my;
+        if (x.loads + x.stores != y.loads + y.stores)
+            return x.loads + x.stores > y.loads + y.stores;
+        return a < b;
+    };
+    top = min(top, used.size());
+    partial_sort(used.begin(), used.begin() + top, used.end(), worse);
+    used.resize(top);
+    return used;
+}
+
+/*--profile report: for each level, the instructions, address ranges and rows with
+the most misses*/
+void print_profile(const CacheSystem &cs, size_t top, ostream &out = cout) {
+    for (const CacheLevel &c : cs.caches.levels) {
+        const char *titles[3] = {"instructions", "address ranges", "rows"};
+        const vector<ProfileCount> *tables[3] = {&c.pcProfile, &c.rangeProfile, &c.rowProfile};
+        for (int t = 0; t < 3; t++) {
+            out << "Profile " << c.name << ": top " << top << " " << titles[t] << " by misses" << endl;
+            out << setw(12) << (t == 0 ? "pc" : t == 1 ? "addresses" : "row") << setw(10) << "lw" << setw(10)
+                << "lw miss" << setw(10) << "sw" << setw(10) << "sw miss" << setw(9) << "miss%";
+            if (t == 2)
+                out << setw(11) << "evictions";
+            out << endl;
+            for (size_t i : worstEntries(*tables[t], top)) {
+                const ProfileCount &p = (*tables[t])[i];
+                uint64_t requests = p.loads + p.stores, misses = p.loadMisses + p.storeMisses;
+                string key = t == 1 ? to_string(i * PROFILE_RANGE) + "-" + to_string((i + 1) * PROFILE_RANGE - 1)
+                                    : to_string(i);
+                out << setw(12) << key << setw(10) << p.loads << setw(10) << p.loadMisses << setw(10) << p.stores
+                    << setw(10) << p.storeMisses << setw(9) << fixed << setprecision(2) << 100.0 * misses / requests;
+                out.unsetf(ios::floatfield);
+                if (t == 2)
+                    out << setw(11) << c.rowEvictions[i];
+                out << endl;
+            }
+        }
+    }
+}
+
+/*writes every non-zero profile entry to path: JSON if it ends in .json, otherwise
+CSV with one line per level, kind (pc, range or row) and index. A range is named by
+its first address. Returns false if the file can't be written*/
+bool dumpProfile(const CacheSystem &cs, const string &path) {
+    ofstream file(path);
+    if (!file.is_open())
+        return false;
+    bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+    const char *kinds[3] = {"pc", "range", "row"};
+    if (json)
+        file << "{\"levels\": [";
+    else
+        file << "level,kind,index,lw,lw_misses,sw,sw_misses,evictions" << endl;
+    for (size_t l = 0; l < cs.caches.levels.size(); l++) {
+        const CacheLevel &c = cs.caches.levels[l];
+        const vector<ProfileCount> *tables[3] = {&c.pcProfile, &c.rangeProfile, &c.rowProfile};
+        if (json)
+            file << (l ? ",\n" : "\n") << "  {\"name\": \"" << c.name << "\"";
+        for (int t = 0; t < 3; t++) {
+            if (json)
+                file << ", \"" << kinds[t] << "s\": [";
+            bool first = true;
+            for (size_t i = 0; i < tables[t]->size(); i++) {
+                const ProfileCount &p = (*tables[t])[i];
+                if (!p.loads && !p.stores)
+                    continue;
+                size_t index = t == 1 ? i * PROFILE_RANGE : i;
+                if (json) {
+                    file << (first ? "" : ", ") << "{\"" << kinds[t] << "\": " << index << ", \"lw\": " << p.loads
+                         << ", \"lw_misses\": " << p.loadMisses << ", \"sw\": " << p.stores << ", \"sw_misses\": "
+                         << p.storeMisses;
+                    if (t == 2)
+                        file << ", \"evictions\": " << c.rowEvictions[i];
+                    file << "}";
+                } else {
+                    file << c.name << "," << kinds[t] << "," << index << "," << p.loads << "," << p.loadMisses << ","
+                         << p.stores << "," << p.storeMisses << ",";
+                    if (t == 2)
+                        file << c.rowEvictions[i];
+                    file << endl;
+                }
+                first = false;
+            }
+            if (json)
+                file << "]";
         }
+        if (json)
+            file << "}";
     }
-    /*Loop through instructions, for each memory cell calculate the opcode and assign proper registers and correct immediate values*/
+    if (json)
+        file << "\n]}" << endl;
+    return file.good();
+}
+
+/*empties every level, keeping its geometry and buffers*/
+void resetcaches(CacheSystem &cs) {
+    buildHierarchy(cs.caches, cs.parts, cs.options);
+}
+
+/*feeds a recorded trace through the caches without running the program.
+Returns the number of accesses replayed, or -1 if the file is not a trace*/
+long long replayTrace(CacheSystem &cs, const char *path) {
+    MappedFile f;
+    if (!f.open(path) || f.size < sizeof TRACE_MAGIC || memcmp(f.data, TRACE_MAGIC, sizeof TRACE_MAGIC) != 0)
+        return -1;
+    long long count = (f.size - sizeof TRACE_MAGIC) / 4;
+    const uint8_t *rec = f.data + sizeof TRACE_MAGIC;
+    for (long long i = 0; i < count; i++, rec += 4) {
+        uint16_t pc = rec[0] | (rec[1] << 8);
+        uint16_t a = rec[2] | (rec[3] << 8);
+        simulatecache(cs, pc, a & 8191, (a & 0x8000) ? 5 : 4);
+    }
+    return count;
+}
+
+/*how far an engine runs and what it does with lw/sw. RUN_FULL simulates the caches
+until halt. RUN_LIMITED also stops once limit instructions have executed, and
+RUN_FAST stops there too but never calls simulatecache (--fast-forward). An engine
+that stops at halt sets *halted*/
+enum RunMode { RUN_FULL, RUN_LIMITED, RUN_FAST };
+
+/*reference engine: one switch on the opcode per instruction, opcode 0 handled by
+executeopcode0. Returns the number of instructions executed.
+Every engine is instantiated with CountOps set only for --timing, so counting the
+operations costs nothing otherwise, and with the RunMode, so an unlimited run
+checks no limit*/
+template <bool CountOps, RunMode Mode>
+uint64_t runSwitch(uint16_t &pc, uint16_t (&reg)[8], uint16_t (&memory)[MEM_SIZE], Instr decoded[],
+                   CacheSystem &cs, uint64_t limit, bool *halted) {
+    bool halt=false;
+    uint64_t executed = 0;
+    uint64_t *opCounts = CountOps ? cs.timing->opCounts : nullptr;
+    /*Loop through instructions, dispatching on the predecoded opcode of each memory cell*/
     while(!halt){
-      opcode[pc&8191]=((memory[pc&8191]>> 13) & 7) ;
-        // define the opcode as the last 4 bits
-        imm4[pc&8191]=(memory[pc&8191]& 15);
-        // define the opcode as the last 13 bits
-        imm13[pc&8191]=(memory[pc&8191]& 8191);
-        // define the opcode as the last 7 bits
-        imm7[pc&8191]=(memory[pc&8191]& 127);
-        RgSrcA[pc&8191]=((memory[pc&8191]>> 10)& 7);
-        RgSrcB[pc&8191]=(((memory[pc&8191]) >>7)& 7);
-        RgDst[pc&8191]=(((memory[pc&8191]) >> 4)& 7); 
-        
-       switch (opcode[pc&8191]) {
+        if (Mode != RUN_FULL && executed == limit)
+            return executed;
+        executed++;
+        const Instr &in = decoded[pc&8191];
+        if (CountOps)
+            opCounts[in.op]++;
+       switch (in.opcode) {
         case 0:
-        executeopcode0(pc, RgSrcA,RgSrcB,RgDst,imm4, reg);
+        executeopcode0(pc, in, reg);
         break;
         case 1:
-        executeopcode1(pc, RgSrcA,RgSrcB,RgDst,imm7, reg);
+        executeopcode1(pc, in, reg);
         break;
         case 2: 
-       executeopcode2(pc,halt,imm13);
+       executeopcode2(pc,halt,in);
         break;
         case 3:
-       executeopcode3(pc, reg[7],imm13);
+       executeopcode3(pc, reg[7],in);
         break;
         case 4:
-        simulatecache(parts,cache_config,pc,imm7,RgSrcA,reg,L1blocksize,num_rows_l1,L1assoc,L1size,cache1,lruQueue1,L2blocksize,num_rows_l2,L2assoc,L2size,cache2,lruQueue2,opcode);
-        executeopcode4(pc,reg,memory,RgSrcA,RgSrcB,imm7);
+        if (Mode != RUN_FAST)
+            simulatecache(cs,pc,memAddress(in,reg),in.opcode);
+        executeopcode4(pc,in,reg,memory);
         break;
         case 5:
-        simulatecache(parts,cache_config,pc,imm7,RgSrcA,reg,L1blocksize,num_rows_l1,L1assoc,L1size,cache1,lruQueue1,L2blocksize,num_rows_l2,L2assoc,L2size,cache2,lruQueue2,opcode);
-        executeopcode5(pc,reg,memory,RgSrcA,RgSrcB,imm7);
+        if (Mode != RUN_FAST)
+            simulatecache(cs,pc,memAddress(in,reg),in.opcode);
+        executeopcode5(pc,in,reg,memory,decoded);
         break;
         case 6:
-       executeopcode6(pc,reg,memory,RgSrcA,RgSrcB,imm7);
+       executeopcode6(pc,in,reg);
         break;
         case 7:
-        executeopcode7(pc,reg,memory,RgSrcA,RgSrcB,imm7);
+        executeopcode7(pc,in,reg);
         break;
     }
    
     }
+    if (halted)
+        *halted = true;
+    return executed;
+}
+
+/*threaded engine: every Op has its own handler and each handler jumps straight to
+the next instruction's handler (GCC computed goto), so there is no central switch
+and no imm4 chain. Must stay observably identical to runSwitch*/
+template <bool CountOps, RunMode Mode>
+uint64_t runThreaded(uint16_t &pc, uint16_t (&reg)[8], uint16_t (&memory)[MEM_SIZE], Instr decoded[],
+                     CacheSystem &cs, uint64_t limit, bool *halted) {
+    uint64_t executed = 0;
+    uint64_t *opCounts = CountOps ? cs.timing->opCounts : nullptr;
+    const Instr *in;
+#if defined(__GNUC__)
+    static void *const handlers[NUM_OPS] = {
+        &&op_ADD, &&op_SUB, &&op_OR, &&op_AND, &&op_SLT, &&op_JR, &&op_NOP,
+        &&op_ADDI, &&op_J, &&op_HALT, &&op_JAL, &&op_LW, &&op_SW, &&op_JEQ, &&op_SLTI
+    };
+#define DISPATCH() do { if (Mode != RUN_FULL && executed == limit) return executed; \
+                         in = &decoded[pc & 8191]; executed++; if (CountOps) opCounts[in->op]++; \
+                         goto *handlers[in->op]; } while (0)
+#define HANDLER(name) op_##name:
+#else
+#define DISPATCH() goto dispatch
+#define HANDLER(name) case OP_##name:
+#endif
+
+#if defined(__GNUC__)
+    DISPATCH();
+#else
+dispatch:
+    if (Mode != RUN_FULL && executed == limit)
+        return executed;
+    in = &decoded[pc & 8191];
+    executed++;
+    if (CountOps)
+        opCounts[in->op]++;
+    switch (in->op) {
+#endif
+    HANDLER(ADD) reg[in->RgDst] = reg[in->RgSrcA] + reg[in->RgSrcB]; pc++; DISPATCH();
+    HANDLER(SUB) reg[in->RgDst] = reg[in->RgSrcA] - reg[in->RgSrcB]; pc++; DISPATCH();
+    HANDLER(OR)  reg[in->RgDst] = reg[in->RgSrcA] | reg[in->RgSrcB]; pc++; DISPATCH();
+    HANDLER(AND) reg[in->RgDst] = reg[in->RgSrcA] & reg[in->RgSrcB]; pc++; DISPATCH();
+    HANDLER(SLT) reg[in->RgDst] = reg[in->RgSrcA] < reg[in->RgSrcB]; pc++; DISPATCH();
+    HANDLER(JR)  pc = reg[in->RgSrcA]; DISPATCH();
+    HANDLER(NOP) pc++; DISPATCH();
+    HANDLER(ADDI) reg[in->RgSrcB] = reg[in->RgSrcA] + in->imm7; pc++; DISPATCH();
+    HANDLER(J)   pc = in->imm13; DISPATCH();
+    HANDLER(JAL) reg[7] = pc + 1; pc = in->imm13; DISPATCH();
+    HANDLER(LW)
+        if (Mode != RUN_FAST)
+            simulatecache(cs,pc,memAddress(*in,reg),in->opcode);
+        executeopcode4(pc,*in,reg,memory);
+        DISPATCH();
+    HANDLER(SW)
+        if (Mode != RUN_FAST)
+            simulatecache(cs,pc,memAddress(*in,reg),in->opcode);
+        executeopcode5(pc,*in,reg,memory,decoded);
+        DISPATCH();
+    HANDLER(JEQ) pc = pc + (reg[in->RgSrcA] == reg[in->RgSrcB] ? in->imm7 : 0) + 1; DISPATCH();
+    HANDLER(SLTI) reg[in->RgSrcB] = reg[in->RgSrcA] < in->imm7; pc++; DISPATCH();
+    HANDLER(HALT) pc = in->imm13;
+#if !defined(__GNUC__)
+    default: break;
+    }
+#endif
+#undef DISPATCH
+#undef HANDLER
+    if (halted)
+        *halted = true;
+    return executed;
+}
+
+/*block engine: straight-line code up to a jump (opcodes 2, 3, 6 or jr) is translated
+once into a list of micro-ops with registers and sign-extended immediates resolved,
+and a whole block runs per dispatch. Blocks are keyed by their start address and
+dropped when a sw writes into the words they were translated from*/
+enum UopKind : uint8_t {
+    U_ADD, U_SUB, U_OR, U_AND, U_SLT, U_ADDI, U_MOVI, U_SLTI, U_LW, U_SW, U_NOP,
+    // terminators, always the last micro-op of a block
+    U_J, U_HALT, U_JAL, U_JEQ, U_JR, U_FALL
+};
+
+struct Uop {
+    uint8_t kind;
+    uint8_t d, a, b;   // destination and source registers
+    uint16_t imm;      // sign-extended imm7, or the jump target
+    uint8_t op;        // the Op it came from, for --timing
+};
+
+size_t const static MAX_BLOCK_LEN = 64;
+
+struct Block {
+    bool valid = false;
+    uint16_t len = 0;  // words of memory covered, starting at the block's address
+    vector<Uop> ops;
+};
+
+struct BlockCache {
+    vector<Block> blocks = vector<Block>(MEM_SIZE);
+    vector<uint16_t> covered = vector<uint16_t>(MEM_SIZE, 0); // valid blocks covering each word
+};
+
+Uop translateInstr(const Instr &in) {
+    Uop u = {U_NOP, 0, in.RgSrcA, in.RgSrcB, in.imm7, in.op};
+    switch (in.op) {
+    case OP_ADD: case OP_SUB: case OP_OR: case OP_AND: case OP_SLT:
+        u.kind = U_ADD + (in.op - OP_ADD);
+        u.d = in.RgDst;
+        break;
+    case OP_ADDI:
+        u.kind = in.RgSrcA == 0 ? U_MOVI : U_ADDI;
+        u.d = in.RgSrcB;
+        break;
+    case OP_SLTI: u.kind = U_SLTI; u.d = in.RgSrcB; break;
+    case OP_LW:   u.kind = U_LW; u.d = in.RgSrcB; break;
+    case OP_SW:   u.kind = U_SW; break;
+    case OP_J:    u.kind = U_J; u.imm = in.imm13; break;
+    case OP_HALT: u.kind = U_HALT; u.imm = in.imm13; break;
+    case OP_JAL:  u.kind = U_JAL; u.imm = in.imm13; break;
+    case OP_JEQ:  u.kind = U_JEQ; break;
+    case OP_JR:   u.kind = U_JR; break;
+    default: break;
+    }
+    return u;
+}
+
+Block &translateBlock(BlockCache &bc, const Instr decoded[], uint16_t start) {
+    Block &blk = bc.blocks[start];
+    blk.ops.clear();
+    uint16_t addr = start;
+    while (true) {
+        Uop u = translateInstr(decoded[addr]);
+        blk.ops.push_back(u);
+        addr = (addr + 1) & 8191;
+        if (u.kind >= U_J)
+            break;
+        if (blk.ops.size() == MAX_BLOCK_LEN) {
+            blk.ops.push_back({U_FALL, 0, 0, 0, 0, OP_NOP});
+            break;
+        }
+    }
+    blk.len = blk.ops.back().kind == U_FALL ? blk.ops.size() - 1 : blk.ops.size();
+    blk.valid = true;
+    for (uint16_t i = 0; i < blk.len; i++)
+        bc.covered[(start + i) & 8191]++;
+    return blk;
+}
+
+// drop every block translated from addr; returns true if the block starting at current was one of them
+bool invalidateBlocks(BlockCache &bc, uint16_t addr, uint16_t current) {
+    bool hitCurrent = false;
+    for (size_t back = 0; back < MAX_BLOCK_LEN && bc.covered[addr]; back++) {
+        uint16_t start = (addr - back) & 8191;
+        Block &blk = bc.blocks[start];
+        if (!blk.valid || back >= blk.len)
+            continue;
+        blk.valid = false;
+        for (uint16_t i = 0; i < blk.len; i++)
+            bc.covered[(start + i) & 8191]--;
+        hitCurrent |= start == current;
+    }
+    return hitCurrent;
+}
+
+/*bc persists across the runs of one program (the windows of a sampled run); it is
+kept coherent by the sw handler, so every run of the program must use this engine*/
+template <bool CountOps, RunMode Mode>
+uint64_t runBlocks(uint16_t &pc, uint16_t (&reg)[8], uint16_t (&memory)[MEM_SIZE], Instr decoded[],
+                   CacheSystem &cs, BlockCache &bc, uint64_t limit, bool *halted) {
+    uint64_t executed = 0;
+    uint64_t *opCounts = CountOps ? cs.timing->opCounts : nullptr;
+    while (true) {
+        uint16_t start = pc & 8191;
+        Block &blk = bc.blocks[start].valid ? bc.blocks[start] : translateBlock(bc, decoded, start);
+        const uint16_t base = pc; // pc of the i-th micro-op is base + i
+        for (size_t i = 0; ; i++) {
+            const Uop &u = blk.ops[i];
+            uint16_t upc = base + i;
+            if (Mode != RUN_FULL && executed == limit) {
+                pc = upc;
+                return executed;
+            }
+            executed++;
+            if (CountOps)
+                opCounts[u.op]++;
+            switch (u.kind) {
+            case U_ADD:  reg[u.d] = reg[u.a] + reg[u.b]; break;
+            case U_SUB:  reg[u.d] = reg[u.a] - reg[u.b]; break;
+            case U_OR:   reg[u.d] = reg[u.a] | reg[u.b]; break;
+            case U_AND:  reg[u.d] = reg[u.a] & reg[u.b]; break;
+            case U_SLT:  reg[u.d] = reg[u.a] < reg[u.b]; break;
+            case U_ADDI: reg[u.d] = reg[u.a] + u.imm; break;
+            case U_MOVI: reg[u.d] = u.imm; break;
+            case U_SLTI: reg[u.d] = reg[u.a] < u.imm; break;
+            case U_NOP:  break;
+            case U_LW: {
+                uint16_t addr = (reg[u.a] + u.imm) & 8191;
+                if (Mode != RUN_FAST)
+                    simulatecache(cs,upc,addr,4);
+                if (u.d != 0)
+                    reg[u.d] = memory[addr];
+                break;
+            }
+            case U_SW: {
+                uint16_t addr = (reg[u.a] + u.imm) & 8191;
+                if (Mode != RUN_FAST)
+                    simulatecache(cs,upc,addr,5);
+                memory[addr] = reg[u.b];
+                decoded[addr] = decodeInstr(memory[addr], addr);
+                if (bc.covered[addr] && invalidateBlocks(bc, addr, start)) {
+                    // the rest of this block may be stale, continue from the next word
+                    pc = upc + 1;
+                    goto next_block;
+                }
+                break;
+            }
+            case U_J:    pc = u.imm; goto next_block;
+            case U_HALT:
+                pc = u.imm;
+                if (halted)
+                    *halted = true;
+                return executed;
+            case U_JAL:  reg[7] = upc + 1; pc = u.imm; goto next_block;
+            case U_JEQ:  pc = upc + (reg[u.a] == reg[u.b] ? u.imm : 0) + 1; goto next_block;
+            case U_JR:   pc = reg[u.a]; goto next_block;
+            case U_FALL:
+                executed--;
+                if (CountOps)
+                    opCounts[u.op]--;
+                pc = upc;
+                goto next_block;
+            }
+        }
+next_block:;
+    }
+}
+
+/*one E20 machine: registers, memory with its predecoded instructions, and the caches.
+resetSimulator clears it in place, so a batch reuses one object per worker for every
+program instead of reallocating the arrays*/
+struct Simulator {
+    uint16_t pc = 0;
+    uint16_t reg[NUM_REGS] = {0};
+    uint16_t memory[MEM_SIZE] = {0};
+    Instr decoded[MEM_SIZE];
+    CacheSystem cs;
+    BlockCache blocks; // the block engine's translations of this program
+};
+
+void resetSimulator(Simulator &sim) {
+    sim.pc = 0;
+    fill(begin(sim.reg), end(sim.reg), 0);
+    fill(begin(sim.memory), end(sim.memory), 0);
+    resetcaches(sim.cs);
+    for (Block &blk : sim.blocks.blocks)
+        blk.valid = false;
+    fill(sim.blocks.covered.begin(), sim.blocks.covered.end(), 0);
+    if (sim.cs.timing)
+        fill(begin(sim.cs.timing->opCounts), end(sim.cs.timing->opCounts), 0);
+}
+
+/*--checkpoint-at/--restore format: an 8 byte magic, the --cache string, then
+little-endian fields: the instruction count, pc, registers, memory, the operation
+counts and, for each level and its prefetcher's shadow, every array and counter a
+later access or the statistics read. The predecoded instructions and the block
+engine's translations are rebuilt from memory on restore.
+snapshotSimulator walks the state once for both directions: a SnapshotWriter
+appends each field, a SnapshotReader overwrites it and checks that the geometry
+and array sizes match the hierarchy built from the saved --cache string*/
+static const char CHECKPOINT_MAGIC[8] = {'E','2','0','C','K','P','1','\n'};
+
+struct SnapshotWriter {
+    vector<uint8_t> buf;
+    bool ok = true;
+
+    void put(uint64_t v, size_t bytes) {
+        for (size_t i = 0; i < bytes; i++)
+            buf.push_back(v >> (8 * i) & 255);
+    }
+    template <typename T> void field(T &x) { put((uint64_t)x, sizeof x); }
+    template <typename T> void same(T x) { field(x); }
+    template <typename T> void array(vector<T> &v) {
+        put(v.size(), 8);
+        for (T &x : v)
+            field(x);
+    }
+    template <typename T> void optional(vector<T> &v) { array(v); }
+    // --profile counters: whatever the run had, possibly nothing
+    void profile(vector<ProfileCount> &v) {
+        put(v.size(), 8);
+        for (ProfileCount &p : v) {
+            field(p.loads);
+            field(p.loadMisses);
+            field(p.stores);
+            field(p.storeMisses);
+        }
+    }
+};
+
+struct SnapshotReader {
+    const uint8_t *p, *end;
+    bool ok = true;
+
+    uint64_t get(size_t bytes) {
+        if ((size_t)(end - p) < bytes) {
+            ok = false;
+            return 0;
+        }
+        uint64_t v = 0;
+        for (size_t i = 0; i < bytes; i++)
+            v |= (uint64_t)*p++ << (8 * i);
+        return v;
+    }
+    template <typename T> void field(T &x) { x = (T)get(sizeof x); }
+    template <typename T> void same(T x) {
+        T saved;
+        field(saved);
+        ok = ok && saved == x;
+    }
+    template <typename T> void array(vector<T> &v) {
+        same((uint64_t)v.size());
+        for (size_t i = 0; ok && i < v.size(); i++)
+            field(v[i]);
+    }
+    /*state only some runs keep (--3c): restored into a run that keeps it, skipped by
+    one that doesn't, and left empty for one that keeps it when the checkpoint has none*/
+    template <typename T> void optional(vector<T> &v) {
+        uint64_t n = get(8);
+        if (n != v.size() && n && !v.empty())
+            ok = false;
+        T skipped;
+        for (uint64_t i = 0; ok && i < n; i++)
+            field(n == v.size() ? v[i] : skipped);
+    }
+    // profile counts restore only into a run that profiles; otherwise they are skipped
+    void profile(vector<ProfileCount> &v) {
+        uint64_t n = get(8);
+        if (n != v.size() && n && !v.empty())
+            ok = false;
+        ProfileCount skipped;
+        for (uint64_t i = 0; ok && i < n; i++) {
+            ProfileCount &c = n == v.size() ? v[i] : skipped;
+            field(c.loads);
+            field(c.loadMisses);
+            field(c.stores);
+            field(c.storeMisses);
+        }
+    }
+};
+
+template <typename Archive>
+void snapshotLevel(Archive &ar, CacheLevel &c) {
+    ar.same(c.size);
+    ar.same(c.assoc);
+    ar.same(c.blocksize);
+    ar.same((int)c.policy);
+    ar.same((int)c.prefetcher);
+    ar.array(c.tags);
+    ar.array(c.valid);
+    ar.array(c.lruPrev);
+    ar.array(c.lruNext);
+    ar.field(c.lruHead);
+    ar.field(c.lruTail);
+    ar.array(c.stamp);
+    ar.array(c.rrpv);
+    ar.array(c.plruBits);
+    ar.field(c.clock);
+    ar.field(c.rng);
+    ar.field(c.hits);
+    ar.field(c.misses);
+    ar.field(c.sws);
+    ar.field(c.evictions);
+    ar.array(c.rowEvictions);
+    ar.field(c.bytesIn);
+    ar.field(c.bytesOut);
+    ar.field(c.writebacks);
+    ar.field(c.requestsBelow);
+    ar.field(c.backInvalidations);
+    ar.field(c.dirtyInvalidations);
+    ar.field(c.victimsIn);
+    ar.array(c.pfTime);
+    ar.array(c.pfVictims);
+    ar.same((uint64_t)c.strideTable.size());
+    for (StrideEntry &e : c.strideTable) {
+        ar.field(e.pc);
+        ar.field(e.last);
+        ar.field(e.stride);
+        ar.field(e.confidence);
+    }
+    ar.same((uint64_t)c.streams.size());
+    for (StreamEntry &e : c.streams) {
+        ar.field(e.last);
+        ar.field(e.dir);
+        ar.field(e.ahead);
+        ar.field(e.used);
+    }
+    ar.field(c.streamClock);
+    ar.field(c.pfIssued);
+    ar.field(c.pfUseful);
+    ar.field(c.pfLate);
+    ar.field(c.pfUnused);
+    ar.field(c.pfPolluting);
+    ar.field(c.shadowMisses);
+    ar.profile(c.pcProfile);
+    ar.profile(c.rangeProfile);
+    ar.profile(c.rowProfile);
+    ar.optional(c.seenBlocks);
+    ar.optional(c.faPrev);
+    ar.optional(c.faNext);
+    ar.field(c.faHead);
+    ar.field(c.faTail);
+    ar.field(c.faBlocks);
+    ar.field(c.compulsory);
+    ar.field(c.capacity);
+    ar.field(c.conflict);
+    ar.field(c.invalidationMisses);
+    ar.same((bool)c.shadow);
+    if (c.shadow && ar.ok)
+        snapshotLevel(ar, *c.shadow);
+}
+
+template <typename Archive>
+void snapshotSimulator(Archive &ar, Simulator &sim, uint64_t &executed) {
+    ar.field(executed);
+    ar.field(sim.pc);
+    for (uint16_t &r : sim.reg)
+        ar.field(r);
+    for (uint16_t &w : sim.memory)
+        ar.field(w);
+    // main counts operations whenever it checkpoints or restores, --timing or not
+    for (uint64_t &n : sim.cs.timing->opCounts)
+        ar.field(n);
+    ar.same((uint64_t)sim.cs.caches.levels.size());
+    for (size_t l = 0; ar.ok && l < sim.cs.caches.levels.size(); l++)
+        snapshotLevel(ar, sim.cs.caches.levels[l]);
+}
+
+bool saveCheckpoint(const char *path, Simulator &sim, uint64_t executed) {
+    SnapshotWriter w;
+    w.buf.insert(w.buf.end(), CHECKPOINT_MAGIC, CHECKPOINT_MAGIC + sizeof CHECKPOINT_MAGIC);
+    w.put(sim.cs.cache_config.size(), 8);
+    w.buf.insert(w.buf.end(), sim.cs.cache_config.begin(), sim.cs.cache_config.end());
+    snapshotSimulator(w, sim, executed);
+    ofstream out(path, ios::binary);
+    out.write((const char *)w.buf.data(), w.buf.size());
+    return (bool)out;
+}
+
+/*the --cache string a checkpoint was taken with, so the caller can build the same
+hierarchy before restoreCheckpoint; false if path is not a checkpoint*/
+bool checkpointConfig(const MappedFile &f, string &cache_config) {
+    if (f.size < sizeof CHECKPOINT_MAGIC + 8 || memcmp(f.data, CHECKPOINT_MAGIC, sizeof CHECKPOINT_MAGIC) != 0)
+        return false;
+    SnapshotReader r{f.data + sizeof CHECKPOINT_MAGIC, f.data + f.size};
+    uint64_t n = r.get(8);
+    if (n > (uint64_t)(r.end - r.p))
+        return false;
+    cache_config.assign((const char *)r.p, n);
+    return true;
+}
+
+/*loads a checkpoint into sim, whose caches must already be configured from
+checkpointConfig. Returns false, leaving sim unusable, if the file doesn't match*/
+bool restoreCheckpoint(const MappedFile &f, Simulator &sim, uint64_t &executed) {
+    SnapshotReader r{f.data + sizeof CHECKPOINT_MAGIC + 8 + sim.cs.cache_config.size(), f.data + f.size};
+    snapshotSimulator(r, sim, executed);
+    if (!r.ok || r.p != r.end)
+        return false;
+    predecode(sim.memory, sim.decoded);
+    for (Block &blk : sim.blocks.blocks)
+        blk.valid = false;
+    fill(sim.blocks.covered.begin(), sim.blocks.covered.end(), 0);
+    return true;
+}
+
+/*runs the loaded program on the chosen engine, to halt or (unless Mode is RUN_FULL)
+for at most limit instructions; returns the instructions executed*/
+template <bool CountOps, RunMode Mode>
+uint64_t runEngine(Simulator &sim, const string &engine, uint64_t limit = 0, bool *halted = nullptr) {
+    if (engine == "threaded")
+        return runThreaded<CountOps, Mode>(sim.pc,sim.reg,sim.memory,sim.decoded,sim.cs,limit,halted);
+    else if (engine == "block")
+        return runBlocks<CountOps, Mode>(sim.pc,sim.reg,sim.memory,sim.decoded,sim.cs,sim.blocks,limit,halted);
+    else
+        return runSwitch<CountOps, Mode>(sim.pc,sim.reg,sim.memory,sim.decoded,sim.cs,limit,halted);
+}
+
+uint64_t runSimulator(Simulator &sim, const string &engine) {
+    return sim.cs.timing ? runEngine<true, RUN_FULL>(sim, engine) : runEngine<false, RUN_FULL>(sim, engine);
+}
+
+/*sampled simulation: fast-forward skips the first instructions with the caches
+bypassed. Then each sample warms the caches for warmup instructions without
+logging or counting, and simulates detail instructions in full (to halt when detail
+is 0). With an interval, a new sample starts every interval instructions, the gaps
+fast-forwarded; without one, everything after the first sample is fast-forwarded*/
+struct SamplingPlan {
+    uint64_t fastForward = 0, warmup = 0, detail = 0, interval = 0;
+    bool active() const { return fastForward || warmup || detail || interval; }
+};
+
+// the counters of a level that a sample measures
+struct LevelCounters {
+    uint64_t hits = 0, misses = 0, sws = 0, evictions = 0, bytesIn = 0, bytesOut = 0, writebacks = 0, requestsBelow = 0;
+    uint64_t compulsory = 0, capacity = 0, conflict = 0, invalidationMisses = 0;
+    uint64_t backInvalidations = 0, dirtyInvalidations = 0, victimsIn = 0;
+    uint64_t pfIssued = 0, pfUseful = 0, pfLate = 0, pfUnused = 0, pfPolluting = 0, shadowMisses = 0;
+    vector<uint64_t> rowEvictions;
+};
+
+/*calls f on each pair of same-named counters of a and b, each a CacheLevel or
+LevelCounters, so every --stats counter is sampled the same way*/
+template <typename A, typename B, typename F>
+void eachCounter(A &a, B &b, F f) {
+    f(a.hits, b.hits);
+    f(a.misses, b.misses);
+    f(a.sws, b.sws);
+    f(a.evictions, b.evictions);
+    f(a.bytesIn, b.bytesIn);
+    f(a.bytesOut, b.bytesOut);
+    f(a.writebacks, b.writebacks);
+    f(a.requestsBelow, b.requestsBelow);
+    f(a.compulsory, b.compulsory);
+    f(a.capacity, b.capacity);
+    f(a.conflict, b.conflict);
+    f(a.invalidationMisses, b.invalidationMisses);
+    f(a.backInvalidations, b.backInvalidations);
+    f(a.dirtyInvalidations, b.dirtyInvalidations);
+    f(a.victimsIn, b.victimsIn);
+    f(a.pfIssued, b.pfIssued);
+    f(a.pfUseful, b.pfUseful);
+    f(a.pfLate, b.pfLate);
+    f(a.pfUnused, b.pfUnused);
+    f(a.pfPolluting, b.pfPolluting);
+    f(a.shadowMisses, b.shadowMisses);
+    for (size_t row = 0; row < a.rowEvictions.size(); row++)
+        f(a.rowEvictions[row], b.rowEvictions[row]);
+}
+
+LevelCounters countersOf(const CacheLevel &c) {
+    LevelCounters t;
+    t.rowEvictions.resize(c.rowEvictions.size());
+    eachCounter(t, c, [](uint64_t &to, uint64_t from) { to = from; });
+    return t;
+}
+
+// what each level counted during the detailed windows, in total and per sample
+struct SampleStats {
+    uint64_t executed = 0, detailed = 0;
+    vector<uint64_t> sampleInstructions;
+    vector<LevelCounters> total;            // per level
+    vector<vector<LevelCounters>> samples;  // per sample, per level
+};
+
+uint64_t runWindow(Simulator &sim, const string &engine, RunMode mode, bool count, uint64_t limit, bool &halted) {
+    if (mode == RUN_FAST)
+        return runEngine<false, RUN_FAST>(sim, engine, limit, &halted);
+    if (mode == RUN_FULL)
+        return count ? runEngine<true, RUN_FULL>(sim, engine, 0, &halted) : runEngine<false, RUN_FULL>(sim, engine, 0, &halted);
+    return count ? runEngine<true, RUN_LIMITED>(sim, engine, limit, &halted)
+                 : runEngine<false, RUN_LIMITED>(sim, engine, limit, &halted);
+}
+
+/*runs the loaded program to halt following plan. Afterwards the --stats counters
+of every level (eachCounter) hold only what the detailed windows counted, so --stats
+and --timing describe the measured instructions; stats has the rest. Returns the
+instructions executed*/
+uint64_t runSampled(Simulator &sim, const string &engine, const SamplingPlan &plan, SampleStats &stats) {
+    vector<CacheLevel> &levels = sim.cs.caches.levels;
+    LogMode logMode = levels.empty() ? LOG_NONE : levels[0].logMode;
+    LogBuffer *logBuf = levels.empty() ? nullptr : levels[0].logBuf;
+    stats = SampleStats();
+    for (const CacheLevel &c : levels) {
+        stats.total.push_back(LevelCounters());
+        stats.total.back().rowEvictions.resize(c.rowEvictions.size());
+    }
+    bool halted = false;
+    uint64_t executed = runWindow(sim, engine, RUN_FAST, false, plan.fastForward, halted);
+    while (!halted) {
+        setlogmode(sim.cs, LOG_NONE, logBuf);
+        uint64_t start = executed;
+        executed += runWindow(sim, engine, RUN_LIMITED, false, plan.warmup, halted);
+        if (halted)
+            break;
+        setlogmode(sim.cs, logMode, logBuf);
+        vector<LevelCounters> before;
+        for (const CacheLevel &c : levels)
+            before.push_back(countersOf(c));
+        uint64_t n = runWindow(sim, engine, plan.detail ? RUN_LIMITED : RUN_FULL, sim.cs.timing, plan.detail, halted);
+        executed += n;
+        stats.detailed += n;
+        stats.sampleInstructions.push_back(n);
+        stats.samples.emplace_back();
+        for (size_t l = 0; l < levels.size(); l++) {
+            LevelCounters d = countersOf(levels[l]);
+            eachCounter(d, before[l], [](uint64_t &to, uint64_t from) { to -= from; });
+            eachCounter(stats.total[l], d, [](uint64_t &to, uint64_t from) { to += from; });
+            stats.samples.back().push_back(move(d));
+        }
+        if (halted)
+            break;
+        // on to the start of the next sample, or to halt
+        uint64_t gap = plan.interval ? plan.interval - (executed - start) : 0;
+        executed += runWindow(sim, engine, RUN_FAST, false, plan.interval ? gap : UINT64_MAX, halted);
+    }
+    setlogmode(sim.cs, logMode, logBuf);
+    for (size_t l = 0; l < levels.size(); l++)
+        eachCounter(levels[l], stats.total[l], [](uint64_t &to, uint64_t from) { to = from; });
+    stats.executed = executed;
+    return executed;
+}
+
+/*--cores: loads each core's program into the shared memory at the address after
+an @ in its name (0 by default) and starts the core there. One program means every
+core runs it; the same file at the same address is loaded once. Returns false,
+after a message, if a program does not fit or overlaps another*/
+bool loadCorePrograms(Simulator &sim, MultiCore &mc, const vector<string> &programs, bool raw) {
+    vector<uint16_t> image(MEM_SIZE);
+    vector<Instr> decoded(MEM_SIZE);
+    vector<string> loaded;
+    vector<pair<size_t, size_t>> ranges; // [start, end) of each loaded program
+    for (size_t i = 0; i < mc.cores.size(); i++) {
+        const string &spec = programs[programs.size() == 1 ? 0 : i];
+        size_t at = spec.rfind('@');
+        string path = spec.substr(0, at);
+        size_t start = 0;
+        if (at != string::npos) {
+            char *end = nullptr;
+            start = strtoul(spec.c_str() + at + 1, &end, 10);
+            if (end == spec.c_str() + at + 1 || *end || start >= MEM_SIZE) {
+                cerr << "Invalid load address in " << spec << endl;
+                return false;
+            }
+        }
+        mc.cores[i].pc = start;
+        if (find(loaded.begin(), loaded.end(), spec) != loaded.end())
+            continue;
+        fill(image.begin(), image.end(), 0);
+        size_t words = load_data_from_file(path.c_str(), image.data(), decoded.data(), raw);
+        if (start + words > MEM_SIZE) {
+            cerr << "Program " << path << " does not fit at address " << start << endl;
+            return false;
+        }
+        for (size_t r = 0; r < ranges.size(); r++)
+            if (start < ranges[r].second && ranges[r].first < start + words) {
+                cerr << "Programs " << loaded[r] << " and " << spec << " overlap" << endl;
+                return false;
+            }
+        copy(image.begin(), image.begin() + words, sim.memory + start);
+        loaded.push_back(spec);
+        ranges.push_back({start, start + words});
+    }
+    predecode(sim.memory, sim.decoded);
+    return true;
+}
+
+/*--cores: runs the cores in turn, quantum instructions each, until all have halted;
+returns the instructions executed by all of them*/
+uint64_t runCores(Simulator &sim, const string &engine, MultiCore &mc, uint64_t quantum) {
+    uint64_t executed = 0;
+    for (bool running = true; running;) {
+        running = false;
+        for (size_t i = 0; i < mc.cores.size(); i++) {
+            Core &core = mc.cores[i];
+            if (core.halted)
+                continue;
+            sim.pc = core.pc;
+            copy(begin(core.reg), end(core.reg), sim.reg);
+            sim.cs.core = i;
+            uint64_t n = runWindow(sim, engine, RUN_LIMITED, false, quantum, core.halted);
+            core.pc = sim.pc;
+            copy(begin(sim.reg), end(sim.reg), core.reg);
+            core.executed += n;
+            executed += n;
+            running |= !core.halted;
+        }
+    }
+    return executed;
+}
+
+// two-sided 95% Student t quantile for df degrees of freedom, the normal one past 30
+double tQuantile95(size_t df) {
+    static const double t[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                               2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                               2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    return df >= 1 && df <= 30 ? t[df - 1] : 1.96;
+}
+
+/*the sampling summary: for each level the measured miss rate with a 95% confidence
+interval over the per-sample miss rates, misses per 1000 instructions, and the
+whole-run hits/misses/sw extrapolated from the detailed instructions*/
+void print_sampling(const CacheSystem &cs, const SampleStats &stats, ostream &out = cout) {
+    size_t n = stats.sampleInstructions.size();
+    double scale = stats.detailed ? (double)stats.executed / stats.detailed : 0.0;
+    out << "Sampling: " << n << (n == 1 ? " sample, " : " samples, ") << stats.detailed << " of " << stats.executed
+        << " instructions detailed (" << fixed << setprecision(2)
+        << (stats.executed ? 100.0 * stats.detailed / stats.executed : 0.0) << "%)" << endl;
+    const vector<CacheLevel> &levels = cs.caches.levels;
+    for (size_t l = 0; l < levels.size(); l++) {
+        const LevelCounters &t = stats.total[l];
+        uint64_t reads = t.hits + t.misses;
+        out << "  " << levels[l].name << " miss rate " << (reads ? 100.0 * t.misses / reads : 0.0) << "%";
+        // the interval is over the samples that made a read at this level
+        vector<double> rates;
+        for (const vector<LevelCounters> &sample : stats.samples)
+            if (sample[l].hits + sample[l].misses)
+                rates.push_back((double)sample[l].misses / (sample[l].hits + sample[l].misses));
+        if (rates.size() > 1) {
+            double mean = 0, var = 0;
+            for (double r : rates)
+                mean += r;
+            mean /= rates.size();
+            for (double r : rates)
+                var += (r - mean) * (r - mean);
+            var /= rates.size() - 1;
+            out << " +/- " << 100.0 * tQuantile95(rates.size() - 1) * sqrt(var / rates.size()) << "% (95%)";
+        }
+        out << ", " << (stats.detailed ? 1000.0 * t.misses / stats.detailed : 0.0) << " misses/1000 instructions" << endl;
+        out << "    estimated whole run: " << (uint64_t)llround(t.hits * scale) << " hits, "
+            << (uint64_t)llround(t.misses * scale) << " misses, " << (uint64_t)llround(t.sws * scale) << " sw" << endl;
+    }
+    out.unsetf(ios::floatfield);
+}
+
+/*--batch: the .bin files named by paths (a directory stands for the .bin files in it),
+in sorted order within a directory*/
+vector<string> batchPrograms(const vector<string> &paths) {
+    vector<string> programs;
+    for (const string &p : paths) {
+        error_code ec;
+        if (filesystem::is_directory(p, ec)) {
+            vector<string> found;
+            for (const auto &entry : filesystem::directory_iterator(p, ec))
+                if (entry.is_regular_file() && entry.path().extension() == ".bin")
+                    found.push_back(entry.path().string());
+            sort(found.begin(), found.end());
+            programs.insert(programs.end(), found.begin(), found.end());
+        } else {
+            programs.push_back(p);
+        }
+    }
+    return programs;
+}
+
+/*runs every program on jobs worker threads, each with one Simulator reset between
+programs, and writes each program's instruction count, cache statistics and final
+state to out in the order given. classify turns on --3c*/
+void runBatch(const vector<string> &programs, const string &cache_config, const string &engine,
+              bool raw, int jobs, const TimingModel *timing, bool classify, ostream &out) {
+    vector<string> results(programs.size());
+    atomic<size_t> next(0);
+    {
+        // report a bad --cache once, before any worker starts
+        CacheSystem check;
+        configurecache(check, cache_config, false);
+    }
+    auto worker = [&]() {
+        unique_ptr<Simulator> sim(new Simulator());
+        configurecache(sim->cs, cache_config, false);
+        setlogmode(sim->cs, LOG_NONE, nullptr);
+        if (classify)
+            startClassify(sim->cs);
+        TimingModel workerTiming;
+        if (timing) {
+            workerTiming = *timing;
+            sim->cs.timing = &workerTiming;
+            setLatencies(sim->cs.caches, workerTiming);
+        }
+        for (size_t i = next++; i < programs.size(); i = next++) {
+            resetSimulator(*sim);
+            load_data_from_file(programs[i].c_str(), sim->memory, sim->decoded, raw);
+            uint64_t executed = runSimulator(*sim, engine);
+            ostringstream o;
+            o << "Program " << programs[i] << endl;
+            o << "Instructions " << executed << endl;
+            print_all_cache_stats(sim->cs, o);
+            if (timing)
+                print_timing(sim->cs, executed, o);
+            print_state(sim->pc, sim->reg, sim->memory, 128, o);
+            results[i] = o.str();
+        }
+    };
+    vector<thread> threads;
+    for (int t = 1; t < jobs; t++)
+        threads.emplace_back(worker);
+    worker();
+    for (thread &t : threads)
+        t.join();
+    for (size_t i = 0; i < results.size(); i++)
+        out << (i ? "\n" : "") << results[i];
+}
+
+/*--bench-cache: nanoseconds per access of the original unordered_map + std::list
+model, of the flat CacheLevel engine's general (division, run-time associativity)
+kernel and of the kernel it selects for the geometry, over one synthetic address
+stream per geometry; then the hit rate and accesses/sec of every replacement policy.
+legacyAccessCache is the original lookup with the logging removed; it is kept
+only as the baseline for this benchmark*/
+bool legacyAccessCache(int address, int BLOCK_SIZE, int ROWS, int ASSOC, std::unordered_map<int, int>& cache, std::list<int>& lruQueue) {
+    int tag = getTag(address, BLOCK_SIZE, ROWS);
+    int index = getIndex(address, BLOCK_SIZE, ROWS);
+    bool found = false;
+    int insertIndex = -1;
+    if (ASSOC == 1) {
+        insertIndex = index;
+        found = cache[index] == tag;
+    } else {
+        int rowStartIndex = index * ASSOC;
+        int rowEndIndex = rowStartIndex + ASSOC - 1;
+        int emptyBlocks = 0;
+        int lruIndex = -1;
+        for (int i = rowStartIndex; i <= rowEndIndex; i++) {
+            if (cache[i] == -1) {
+                emptyBlocks++;
+                insertIndex = i;
+            } else if (cache[i] == tag) {
+                found = true;
+                insertIndex = i;
+                lruIndex = i;
+                break;
+            } else if (lruIndex == -1 || lruQueue.front() == i) {
+                lruIndex = i;
+            }
+        }
+        if (!found && insertIndex == -1) {
+            int evictIndex = lruQueue.front();
+            if (evictIndex >= rowStartIndex && evictIndex <= rowEndIndex) {
+                cache[evictIndex] = -1;
+                insertIndex = evictIndex;
+            } else if (emptyBlocks > 0) {
+                insertIndex = rowStartIndex + emptyBlocks - 1;
+            } else {
+                cache[lruIndex] = -1;
+                insertIndex = lruIndex;
+            }
+        }
+    }
+    cache[insertIndex] = tag;
+    lruQueue.remove(insertIndex);
+    lruQueue.push_back(insertIndex);
+    return found;
+}
+
+// synthetic stream: mostly short strides around a moving base, with random jumps
+vector<int> benchAddresses(size_t count) {
+    vector<int> addrs(count);
+    uint32_t seed = 12345;
+    int base = 0;
+    for (size_t i = 0; i < count; i++) {
+        seed = seed * 1103515245u + 12345u;
+        uint32_t r = seed >> 8;
+        if (r % 8 == 0)
+            base = (r >> 3) & 8191;
+        else
+            base = (base + (int)(r % 5)) & 8191;
+        addrs[i] = base;
+    }
+    return addrs;
+}
+
+// runs fn over the stream until at least minSeconds have elapsed, returns accesses/sec
+template <typename Fn>
+double benchRate(const vector<int> &addrs, double minSeconds, long long &hits, Fn fn) {
+    auto start = chrono::steady_clock::now();
+    size_t done = 0;
+    double elapsed = 0;
+    hits = 0;
+    do {
+        size_t end = min(addrs.size(), done % addrs.size() + 4096);
+        for (size_t i = done % addrs.size(); i < end; i++) {
+            hits += fn(addrs[i]);
+            done++;
+        }
+        elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    } while (elapsed < minSeconds);
+    return done / elapsed;
+}
+
+int benchCache() {
+    const int sizes[] = {16, 64, 256, 1024, 4096};
+    const int assocs[] = {1, 2, 4, 8, 16};
+    const int blocksize = 4;
+    vector<int> addrs = benchAddresses(1 << 20);
+    // (size, assoc, blocksize): every power of two geometry above, then two that are not
+    vector<array<int, 3>> geometries;
+    for (int size : sizes)
+        for (int assoc : assocs)
+            if (size >= assoc * blocksize)
+                geometries.push_back({size, assoc, blocksize});
+    geometries.push_back({96, 2, 3});
+    geometries.push_back({1536, 4, 3});
+    cout << left << setw(8) << "size" << setw(8) << "assoc" << setw(8) << "block" << setw(12) << "legacy ns"
+         << setw(12) << "general ns" << setw(12) << "kernel ns" << "kernel" << endl;
+    for (const array<int, 3> &g : geometries) {
+        int size = g[0], assoc = g[1], block = g[2];
+        int rows = getRow(size, block, assoc);
+        unordered_map<int, int> legacy;
+        list<int> lruQueue;
+        for (int i = 0; i < rows * assoc; i++)
+            legacy[i] = -1;
+        CacheLevel general, kernel;
+        initializecache(general, "L1", size, assoc, block);
+        general.lookup = lookupCacheT<LegacyPolicy, false, 0>;
+        initializecache(kernel, "L1", size, assoc, block);
+        long long legacyHits, generalHits, kernelHits;
+        double legacyRate = benchRate(addrs, 0.2, legacyHits, [&](int a) {
+            return legacyAccessCache(a, block, rows, assoc, legacy, lruQueue);
+        });
+        double generalRate = benchRate(addrs, 0.2, generalHits, [&](int a) {
+            int index;
+            return lookupCache(general, a, index);
+        });
+        double kernelRate = benchRate(addrs, 0.2, kernelHits, [&](int a) {
+            int index;
+            return lookupCache(kernel, a, index);
+        });
+        string name = string(kernel.pow2 ? "shift" : "division") +
+            (assoc == 1 || assoc == 2 || assoc == 4 || assoc == 8 ? ", " + to_string(assoc) + "-way" : "");
+        cout << left << setw(8) << size << setw(8) << assoc << setw(8) << block << fixed << setprecision(2)
+             << setw(12) << 1e9 / legacyRate << setw(12) << 1e9 / generalRate << setw(12) << 1e9 / kernelRate
+             << name << endl;
+    }
+
+    // hit rate of each replacement policy over one pass of the stream, and its cost
+    const int policySizes[] = {64, 256, 1024};
+    const int policyAssocs[] = {4, 16};
+    cout << endl << left << setw(8) << "size" << setw(8) << "assoc" << setw(8) << "policy"
+         << setw(10) << "hit%" << "acc/s" << endl;
+    for (int size : policySizes) {
+        for (int assoc : policyAssocs) {
+            for (int p = 0; p < NUM_POLICIES; p++) {
+                LevelOptions policy;
+                policy.policy = (ReplPolicy)p;
+                CacheLevel c;
+                initializecache(c, "L1", size, assoc, blocksize, policy);
+                long long hits = 0;
+                int index;
+                for (int a : addrs)
+                    hits += lookupCache(c, a, index);
+                double hitRate = 100.0 * hits / addrs.size();
+                initializecache(c, "L1", size, assoc, blocksize, policy);
+                double rate = benchRate(addrs, 0.2, hits, [&](int a) {
+                    return lookupCache(c, a, index);
+                });
+                cout << left << setw(8) << size << setw(8) << assoc << setw(8) << policyNames[p]
+                     << fixed << setprecision(2) << setw(10) << hitRate << setprecision(0) << rate << endl;
+            }
+        }
+    }
+    cout.unsetf(ios::floatfield);
+    return 0;
+}
+
+/*--generate: synthetic E20 programs for parametric access patterns. A program
+starts with a jump over a pool of constants and counters at addresses 1..63,
+which any instruction can reach as K($0); the code follows, and the data the
+pattern reads starts at WORKLOAD_DATA. Each code word keeps its assembly text
+for the ram[N] = 16'b...; // comment it is written with*/
+size_t const static WORKLOAD_DATA = 256;
+
+struct ProgramBuilder {
+    vector<uint16_t> words = vector<uint16_t>(1); // 0 becomes the jump over the pool
+    vector<string> text = vector<string>(1);
+    size_t pool = 0, code = 0; // words in the pool, address of the first instruction
+
+    // a pool word holding value, allocated before any code is emitted
+    int constant(uint16_t value) {
+        words.push_back(value);
+        text.push_back("");
+        return (int)++pool;
+    }
+    int emit(uint16_t word, const string &assembly) {
+        if (!code) {
+            code = words.size();
+            words[0] = (2 << 13) | code;
+            text[0] = "j " + to_string(code);
+        }
+        words.push_back(word);
+        text.push_back(assembly);
+        return (int)words.size() - 1;
+    }
+    int here() const { return (int)words.size(); }
+    static string r(int reg) { return "$" + to_string(reg); }
+    void add(int dst, int a, int b) { emit((a << 10) | (b << 7) | (dst << 4), "add " + r(dst) + "," + r(a) + "," + r(b)); }
+    void addi(int dst, int src, int imm) {
+        emit((1 << 13) | (src << 10) | (dst << 7) | (imm & 127), "addi " + r(dst) + "," + r(src) + "," + to_string(imm));
+    }
+    void lw(int dst, int imm, int addr) {
+        emit((4 << 13) | (addr << 10) | (dst << 7) | (imm & 127), "lw " + r(dst) + "," + to_string(imm) + "(" + r(addr) + ")");
+    }
+    void sw(int src, int imm, int addr) {
+        emit((5 << 13) | (addr << 10) | (src << 7) | (imm & 127), "sw " + r(src) + "," + to_string(imm) + "(" + r(addr) + ")");
+    }
+    void j(int target) { emit((2 << 13) | target, "j " + to_string(target)); }
+    void halt() { j((int)words.size()); text.back() = "halt"; }
+    // counts reg down and loops back to top while it is not zero
+    void loop(int reg, int top) {
+        addi(reg, reg, -1);
+        emit((6 << 13) | (reg << 10) | 1, "jeq " + r(reg) + ",$0,1");
+        j(top);
+    }
+    // the same for a counter kept in pool word counter, using reg to update it
+    void loopMem(int counter, int reg, int top) {
+        lw(reg, counter, 0);
+        addi(reg, reg, -1);
+        sw(reg, counter, 0);
+        emit((6 << 13) | (reg << 10) | 1, "jeq " + r(reg) + ",$0,1");
+        j(top);
+    }
+    // a data word at address, once the code is complete
+    void place(size_t address, uint16_t value) {
+        if (words.size() <= address) {
+            words.resize(address + 1, 0);
+            text.resize(address + 1);
+        }
+        words[address] = value;
+    }
+};
+
+// next value of the generator's LCG, as benchAddresses uses
+inline uint32_t workloadRandom(uint32_t &seed) {
+    seed = seed * 1103515245u + 12345u;
+    return seed >> 8;
+}
+
+/*builds the program SPEC describes into b: a pattern name, then optional
+key=value parameters separated by commas. Returns an error message, or nullptr*/
+const char *generateWorkload(const string &spec, ProgramBuilder &b) {
+    size_t colon = spec.find(':');
+    string pattern = spec.substr(0, colon);
+    vector<pair<string, long>> p;
+    if (pattern == "stride")
+        p = {{"stride", 1}, {"count", 1024}, {"reps", 10}};
+    else if (pattern == "sweep")
+        p = {{"size", 1024}, {"reps", 10}};
+    else if (pattern == "gather")
+        p = {{"count", 1024}, {"range", 4096}, {"reps", 10}, {"seed", 1}};
+    else if (pattern == "chase")
+        p = {{"nodes", 1024}, {"spacing", 4}, {"steps", 1024}, {"reps", 10}, {"seed", 1}};
+    else if (pattern == "tile")
+        p = {{"rows", 64}, {"cols", 64}, {"tile", 8}, {"reps", 10}};
+    else
+        return "unknown pattern";
+    auto lookup = [&](const string &key) {
+        return find_if(p.begin(), p.end(), [&](const pair<string, long> &kv) { return kv.first == key; });
+    };
+    for (size_t start = colon; start != string::npos && start + 1 < spec.size();) {
+        size_t end = spec.find(',', start + 1);
+        string field = spec.substr(start + 1, end == string::npos ? string::npos : end - start - 1);
+        size_t eq = field.find('=');
+        auto known = lookup(field.substr(0, eq));
+        char *stop = nullptr;
+        long value = eq == string::npos ? 0 : strtol(field.c_str() + eq + 1, &stop, 10);
+        if (eq == string::npos || known == p.end() || stop == field.c_str() + eq + 1 || *stop)
+            return "bad parameter";
+        known->second = value;
+        start = end;
+    }
+    for (auto &kv : p)
+        if (kv.second < 1 || kv.second > 65535)
+            return "parameters must be between 1 and 65535";
+    auto param = [&](const string &key) { return lookup(key)->second; };
+    const long room = MEM_SIZE - WORKLOAD_DATA;
+    uint32_t seed = pattern == "gather" || pattern == "chase" ? param("seed") : 0;
+
+    if (pattern == "stride" || pattern == "sweep") {
+        // reps passes over count words stride apart, summing them
+        long stride = pattern == "sweep" ? 1 : param("stride"), count = pattern == "sweep" ? param("size") : param("count");
+        if ((count - 1) * stride >= room)
+            return "the array does not fit in memory";
+        int base = b.constant(WORKLOAD_DATA), n = b.constant(count);
+        int step = b.constant(stride), reps = b.constant(param("reps"));
+        b.lw(6, step, 0);
+        b.lw(5, reps, 0);
+        int outer = b.here();
+        b.lw(1, base, 0);
+        b.lw(2, n, 0);
+        int inner = b.here();
+        b.lw(3, 0, 1);
+        b.add(4, 4, 3);
+        b.add(1, 1, 6);
+        b.loop(2, inner);
+        b.loop(5, outer);
+        b.halt();
+    } else if (pattern == "gather") {
+        // reps passes over a table of count random addresses within range words, summing what they point at
+        long count = param("count"), range = param("range");
+        if (count + range > room)
+            return "the table and the array do not fit in memory";
+        int table = b.constant(WORKLOAD_DATA), n = b.constant(count);
+        int reps = b.constant(param("reps"));
+        b.lw(5, reps, 0);
+        int outer = b.here();
+        b.lw(1, table, 0);
+        b.lw(2, n, 0);
+        int inner = b.here();
+        b.lw(3, 0, 1);
+        b.lw(3, 0, 3);
+        b.add(4, 4, 3);
+        b.addi(1, 1, 1);
+        b.loop(2, inner);
+        b.loop(5, outer);
+        b.halt();
+        for (long i = 0; i < count; i++)
+            b.place(WORKLOAD_DATA + i, WORKLOAD_DATA + count + workloadRandom(seed) % range);
+    } else if (pattern == "chase") {
+        // follows a random cycle through nodes words spacing apart, steps loads per rep
+        long nodes = param("nodes"), spacing = param("spacing");
+        if ((nodes - 1) * spacing >= room)
+            return "the nodes do not fit in memory";
+        vector<long> order(nodes);
+        for (long i = 0; i < nodes; i++)
+            order[i] = i;
+        for (long i = nodes - 1; i > 0; i--) // Sattolo's shuffle: one cycle through every node
+            swap(order[i], order[workloadRandom(seed) % i]);
+        int start = b.constant(WORKLOAD_DATA + order[0] * spacing), steps = b.constant(param("steps"));
+        int reps = b.constant(param("reps"));
+        b.lw(1, start, 0);
+        b.lw(5, reps, 0);
+        int outer = b.here();
+        b.lw(2, steps, 0);
+        int inner = b.here();
+        b.lw(1, 0, 1);
+        b.loop(2, inner);
+        b.loop(5, outer);
+        b.halt();
+        for (long i = 0; i < nodes; i++)
+            b.place(WORKLOAD_DATA + order[i] * spacing, WORKLOAD_DATA + order[(i + 1) % nodes] * spacing);
+    } else {
+        // reads a rows x cols row-major matrix one tile x tile block at a time; the tile loop counters live in the pool
+        long rows = param("rows"), cols = param("cols"), tile = param("tile");
+        if (rows * cols > room)
+            return "the matrix does not fit in memory";
+        if (rows % tile || cols % tile)
+            return "tile must divide rows and cols";
+        int base = b.constant(WORKLOAD_DATA), width = b.constant(cols);
+        int side = b.constant(tile), band = b.constant(tile * cols);
+        int tileRows = b.constant(rows / tile), tileCols = b.constant(cols / tile);
+        int reps = b.constant(param("reps"));
+        int repsLeft = b.constant(0), bandsLeft = b.constant(0);
+        int tilesLeft = b.constant(0);
+        b.lw(6, reps, 0);
+        b.sw(6, repsLeft, 0);
+        int rep = b.here();
+        b.lw(1, base, 0);
+        b.lw(6, tileRows, 0);
+        b.sw(6, bandsLeft, 0);
+        int bandLoop = b.here();
+        b.add(2, 1, 0);
+        b.lw(6, tileCols, 0);
+        b.sw(6, tilesLeft, 0);
+        int tileLoop = b.here();
+        b.add(3, 2, 0);
+        b.lw(6, side, 0);
+        int rowLoop = b.here();
+        b.add(4, 3, 0);
+        b.lw(7, side, 0);
+        int colLoop = b.here();
+        b.lw(5, 0, 4);
+        b.addi(4, 4, 1);
+        b.loop(7, colLoop);
+        b.lw(5, width, 0);
+        b.add(3, 3, 5);
+        b.loop(6, rowLoop);
+        b.lw(5, side, 0);
+        b.add(2, 2, 5);
+        b.loopMem(tilesLeft, 6, tileLoop);
+        b.lw(5, band, 0);
+        b.add(1, 1, 5);
+        b.loopMem(bandsLeft, 6, bandLoop);
+        b.loopMem(repsLeft, 6, rep);
+        b.halt();
+    }
+    return nullptr;
+}
+
+// the program in the ram[N] = 16'b...; format load_data_from_file reads
+void write_ram_text(const ProgramBuilder &b, ostream &out) {
+    for (size_t i = 0; i < b.words.size(); i++) {
+        out << "ram[" << i << "] = 16'b" << bitset<16>(b.words[i]) << ";";
+        if (!b.text[i].empty())
+            out << "\t\t// " << b.text[i];
+        out << "\n";
+    }
+}
+
+/*--bench-workloads and --generate-suite: patterns at sizes that each make a few
+million memory accesses; the sweep runs one working set per size*/
+const char *const WORKLOAD_SUITE[] = {
+    "stride:stride=1,count=4096,reps=400",
+    "stride:stride=8,count=512,reps=3200",
+    "stride:stride=64,count=120,reps=13650",
+    "sweep:size=64,reps=25600",
+    "sweep:size=256,reps=6400",
+    "sweep:size=1024,reps=1600",
+    "sweep:size=4096,reps=400",
+    "gather:count=2048,range=4096,reps=400",
+    "chase:nodes=1024,spacing=4,steps=4096,reps=400",
+    "tile:rows=64,cols=64,tile=8,reps=400",
+};
+
+// a file name for spec: its pattern and parameter values
+string workloadName(const string &spec) {
+    string name;
+    for (char ch : spec)
+        name += isalnum((unsigned char)ch) ? ch : ch == '=' ? '\0' : '-';
+    name.erase(remove(name.begin(), name.end(), '\0'), name.end());
+    return name;
+}
+
+/*what one timed workload run measured: instructions and lw/sw from a counting
+run, the best of BENCH_RUNS wall times of uncounted runs, and the peak resident
+set of the process that ran it in KB (0 where it can't be measured)*/
+struct WorkloadResult {
+    uint64_t instructions = 0, accesses = 0;
+    double seconds = 0;
+    long peakKB = 0;
+};
+
+int const static BENCH_RUNS = 3;
+
+WorkloadResult timeWorkload(const ProgramBuilder &b, const string &cache_config, const string &engine) {
+    WorkloadResult res;
+    unique_ptr<Simulator> sim(new Simulator());
+    configurecache(sim->cs, cache_config, false);
+    setlogmode(sim->cs, LOG_NONE, nullptr);
+    TimingModel counts;
+    for (int run = 0; run <= BENCH_RUNS; run++) {
+        sim->cs.timing = run == 0 ? &counts : nullptr; // the first run only counts
+        resetSimulator(*sim);
+        copy(b.words.begin(), b.words.end(), sim->memory);
+        predecode(sim->memory, sim->decoded);
+        auto start = chrono::steady_clock::now();
+        res.instructions = runSimulator(*sim, engine);
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (run == 1 || (run > 1 && elapsed < res.seconds))
+            res.seconds = elapsed;
+    }
+    res.accesses = counts.opCounts[OP_LW] + counts.opCounts[OP_SW];
+    return res;
+}
+
+/*times every workload, each in a child process so that its peak RSS is its own.
+Returns 1 if a workload spec is invalid*/
+int benchWorkloads(const vector<string> &specs, const string &cache_config, const string &engine) {
+    {
+        CacheSystem check;
+        configurecache(check, cache_config, false);
+    }
+    vector<ProgramBuilder> programs(specs.size());
+    for (size_t i = 0; i < specs.size(); i++)
+        if (const char *error = generateWorkload(specs[i], programs[i])) {
+            cerr << "Invalid workload " << specs[i] << ": " << error << endl;
+            return 1;
+        }
+    cout << left << setw(50) << "workload" << setw(14) << "instructions" << setw(12) << "accesses"
+         << setw(10) << "best s" << setw(14) << "instr/s" << setw(14) << "accesses/s" << "peak RSS KB" << endl;
+    for (size_t i = 0; i < specs.size(); i++) {
+        const ProgramBuilder &b = programs[i];
+        WorkloadResult res;
+#if defined(__unix__) || defined(__APPLE__)
+        int fds[2];
+        pid_t pid = -1;
+        if (pipe(fds) != 0)
+            cerr << "Can't open a pipe for " << specs[i] << ", timing it in this process" << endl;
+        else if ((pid = fork()) < 0) {
+            close(fds[0]);
+            close(fds[1]);
+            cerr << "Can't fork for " << specs[i] << ", timing it in this process" << endl;
+        }
+        if (pid == 0) {
+            close(fds[0]);
+            res = timeWorkload(b, cache_config, engine);
+            ssize_t written = write(fds[1], &res, sizeof res);
+            _exit(written == (ssize_t)sizeof res ? 0 : 1);
+        }
+        if (pid > 0) {
+            close(fds[1]);
+            ssize_t got = read(fds[0], &res, sizeof res);
+            close(fds[0]);
+            int status;
+            struct rusage usage;
+            if (wait4(pid, &status, 0, &usage) == pid && got == (ssize_t)sizeof res)
+#if defined(__APPLE__)
+                res.peakKB = usage.ru_maxrss / 1024; // bytes there
+#else
+                res.peakKB = usage.ru_maxrss;
+#endif
+        } else
+#endif
+            res = timeWorkload(b, cache_config, engine);
+        double seconds = max(res.seconds, 1e-9);
+        cout << left << setw(50) << specs[i] << setw(14) << res.instructions << setw(12) << res.accesses << fixed
+             << setprecision(4) << setw(10) << res.seconds << setprecision(0) << setw(14)
+             << res.instructions / seconds << setw(14) << res.accesses / seconds;
+        cout.unsetf(ios::floatfield);
+        if (res.peakKB)
+            cout << res.peakKB;
+        else
+            cout << "-";
+        cout << endl;
+    }
+    return 0;
+}
+
+
+int main(int argc, char *argv[]) {
+     //define the necessary variables and constants 
+ char *filename = nullptr;
+    bool do_help = false;
+    bool arg_error = false;
+    bool do_bench_cache = false;
+    bool do_bench_workloads = false;
+    char *generate_spec = nullptr;
+    char *generate_suite = nullptr;
+    bool do_print_state = false;
+    bool do_throughput = false;
+    bool do_stats = false;
+    bool do_buffered_log = false;
+    LogBuffer logBuf;
+    string engine = "switch";
+    string cache_config;
+    char *record_trace = nullptr;
+    char *replay_trace = nullptr;
+    TraceWriter traceWriter;
+    vector<string> sweep_specs;
+    int stack_blocksize = 0;
+    bool raw_image = false;
+    char *save_image = nullptr;
+    vector<uint16_t> captured;
+    SweepSet sweepSet;
+    bool do_batch = false;
+    int jobs = 1;
+    char *batch_output = nullptr;
+    vector<string> batch_paths;
+    bool do_timing = false;
+    TimingModel timing;
+    size_t profile_top = 0; // entries per --profile table, 0 when not profiling
+    char *profile_out = nullptr;
+    bool do_classify = false;
+    SamplingPlan plan;
+    uint64_t checkpoint_at = 0;
+    char *checkpoint_file = nullptr;
+    char *restore_file = nullptr;
+    size_t cores = 0; // --cores, 0 for the single core simulator
+    uint64_t quantum = 1;
+    MultiCore multi;
+    unique_ptr<Simulator> sim(new Simulator());
+    CacheSystem &cs = sim->cs;
+      
+    /*get the cache configuration*/
+    for (int i=1; i<argc; i++) {
+        string arg(argv[i]);
+        if (arg.rfind("-",0)==0) {
+            if (arg== "-h" || arg == "--help")
+                do_help = true;
+            else if (arg=="--cache") {
+                i++;
+                if (i>=argc)
+                    arg_error = true;
+                else
+                    cache_config = argv[i];
+            }
+            else if (arg=="--bench-cache")
+                do_bench_cache = true;
+            else if (arg=="--bench-workloads")
+                do_bench_workloads = true;
+            else if (arg=="--generate") {
+                i++;
+                if (i>=argc)
+                    arg_error = true;
+                else
+                    generate_spec = argv[i];
+            }
+            else if (arg=="--generate-suite") {
+                i++;
+                if (i>=argc)
+                    arg_error = true;
+                else
+                    generate_suite = argv[i];
+            }
+            else if (arg=="--print-state")
+                do_print_state = true;
+            else if (arg=="--throughput")
+                do_throughput = true;
+            else if (arg=="--stats")
+                do_stats = true;
+            else if (arg=="--3c")
+                do_classify = true;
+            else if (arg=="--buffered-log")
+                do_buffered_log = true;
+            else if (arg=="--batch")
+                do_batch = true;
+            else if (arg=="--jobs") {
+                i++;
+                if (i>=argc || (jobs = atoi(argv[i])) <= 0)
+                    arg_error = true;
+            }
+            else if (arg=="--batch-output") {
+                i++;
+                if (i>=argc)
+                    arg_error = true;
+                else
+                    batch_output = argv[i];
+            }
+            else if (arg=="--raw")
+                raw_image = true;
+            else if (arg=="--save-image") {
+                i++;
+                if (i>=argc)
+                    arg_error = true;
+                else
+                    save_image = argv[i];
+            }
+            else if (arg=="--stack-distance") {
+                i++;
+                if (i>=argc || (stack_blocksize = atoi(argv[i])) <= 0)
+                    arg_error = true;
+            }
+            else if (arg=="--sweep") {
+                i++;
+                if (i>=argc)
+                    arg_error = true;
+                else
+                    sweep_specs.push_back(argv[i]);
+            }
+            else if (arg=="--record-trace" || arg=="--replay-trace") {
+                i++;
+                if (i>=argc)
+                    arg_error = true;
+                else if (arg=="--record-trace")
+                    record_trace = argv[i];
+                else
+                    replay_trace = argv[i];
+            }
+            else if (arg=="--profile")
+                profile_top = max(profile_top, PROFILE_TOP);
+            else if (arg.rfind("--profile=",0)==0) {
+                profile_top = atoi(arg.c_str() + 10);
+                if (profile_top == 0)
+                    arg_error = true;
+            }
+            else if (arg=="--profile-out") {
+                i++;
+                if (i>=argc)
+                    arg_error = true;
+                else
+                    profile_out = argv[i];
+            }
+            else if (arg=="--fast-forward" || arg=="--warmup" || arg=="--detail" || arg=="--sample-interval") {
+                i++;
+                char *end = nullptr;
+                uint64_t n = i < argc ? strtoull(argv[i], &end, 10) : 0;
+                if (i>=argc || end == argv[i] || *end || argv[i][0] == '-')
+                    arg_error = true;
+                else if (arg=="--fast-forward")
+                    plan.fastForward = n;
+                else if (arg=="--warmup")
+                    plan.warmup = n;
+                else if (arg=="--detail")
+                    plan.detail = n;
+                else
+                    plan.interval = n;
+            }
+            else if (arg=="--checkpoint-at") {
+                i += 2;
+                char *end = nullptr;
+                if (i>=argc || (checkpoint_at = strtoull(argv[i - 1], &end, 10)) == 0 || *end)
+                    arg_error = true;
+                else
+                    checkpoint_file = argv[i];
+            }
+            else if (arg=="--restore") {
+                i++;
+                if (i>=argc)
+                    arg_error = true;
+                else
+                    restore_file = argv[i];
+            }
+            else if (arg=="--cores" || arg=="--quantum") {
+                i++;
+                char *end = nullptr;
+                uint64_t n = i < argc ? strtoull(argv[i], &end, 10) : 0;
+                if (i>=argc || n == 0 || *end || argv[i][0] == '-')
+                    arg_error = true;
+                else if (arg=="--cores")
+                    cores = n;
+                else
+                    quantum = n;
+            }
+            else if (arg=="--timing")
+                do_timing = true;
+            else if (arg.rfind("--timing=",0)==0) {
+                do_timing = true;
+                if (!parseTiming(arg.substr(9), timing))
+                    arg_error = true;
+            }
+            else if (arg.rfind("--engine=",0)==0) {
+                engine = arg.substr(9);
+                if (engine != "switch" && engine != "threaded" && engine != "block")
+                    arg_error = true;
+            }
+            else
+                arg_error = true;
+        } else {
+            batch_paths.push_back(argv[i]);
+            if (filename == nullptr)
+                filename = argv[i];
+        }
+    }
+    // only --batch, --bench-workloads and --cores take more than one program (--cores one per core), and --restore takes none
+    if ((batch_paths.size() > 1 && !do_batch && !do_bench_workloads && !(cores && batch_paths.size() == cores)) ||
+        (restore_file && filename))
+        arg_error = true;
+    // a sample starts every interval instructions, so each must fit in one
+    if (plan.interval && (plan.detail == 0 || plan.interval < plan.warmup + plan.detail)) {
+        cerr << "--sample-interval must be at least --warmup plus a nonzero --detail" << endl;
+        return 1;
+    }
+    if (plan.active() && (do_batch || replay_trace || record_trace || !sweep_specs.empty() || stack_blocksize)) {
+        cerr << "sampling cannot be combined with --batch, traces, --sweep or --stack-distance" << endl;
+        return 1;
+    }
+    if ((checkpoint_file || restore_file) &&
+        (plan.active() || do_batch || replay_trace || !sweep_specs.empty() || stack_blocksize || save_image)) {
+        cerr << "--checkpoint-at and --restore cannot be combined with sampling, --batch, --replay-trace, --sweep, --stack-distance or --save-image" << endl;
+        return 1;
+    }
+    if (cores && (plan.active() || checkpoint_file || restore_file || do_batch || record_trace || replay_trace ||
+                  !sweep_specs.empty() || stack_blocksize || save_image || do_timing || profile_top || profile_out)) {
+        cerr << "--cores cannot be combined with sampling, checkpoints, --batch, traces, --sweep, --stack-distance, --save-image, --timing or --profile" << endl;
+        return 1;
+    }
+
+    if (do_batch && !arg_error && !do_help && !batch_paths.empty()) {
+        if (!sweep_specs.empty() || record_trace || replay_trace || stack_blocksize || save_image || profile_top ||
+            profile_out) {
+            cerr << "--batch cannot be combined with --sweep, traces, --stack-distance, --profile or --save-image" << endl;
+            return 1;
+        }
+        vector<string> programs = batchPrograms(batch_paths);
+        ofstream file;
+        if (batch_output) {
+            file.open(batch_output);
+            if (!file.is_open()) {
+                cerr << "Can't open file "<<batch_output<<endl;
+                return 1;
+            }
+        }
+        auto start = chrono::steady_clock::now();
+        runBatch(programs, cache_config, engine, raw_image, jobs, do_timing ? &timing : nullptr, do_classify,
+                 batch_output ? (ostream &)file : cout);
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        if (do_throughput)
+            cerr << "batch: " << programs.size() << " programs in " << elapsed << " s" << endl;
+        return 0;
+    }
+
+    if (do_bench_cache && !arg_error && !do_help)
+        return benchCache();
+
+    if (generate_spec && !arg_error && !do_help) {
+        ProgramBuilder b;
+        if (const char *error = generateWorkload(generate_spec, b)) {
+            cerr << "Invalid workload " << generate_spec << ": " << error << endl;
+            return 1;
+        }
+        write_ram_text(b, cout);
+        return 0;
+    }
+
+    if (generate_suite && !arg_error && !do_help) {
+        error_code ec;
+        filesystem::create_directories(generate_suite, ec);
+        for (const char *spec : WORKLOAD_SUITE) {
+            ProgramBuilder b;
+            generateWorkload(spec, b);
+            string path = string(generate_suite) + "/" + workloadName(spec) + ".bin";
+            ofstream file(path);
+            if (!file.is_open()) {
+                cerr << "Can't open file " << path << endl;
+                return 1;
+            }
+            write_ram_text(b, file);
+        }
+        return 0;
+    }
+
+    if (do_bench_workloads && !arg_error && !do_help) {
+        // the given programs' specs, or the built-in suite
+        vector<string> specs(batch_paths.begin(), batch_paths.end());
+        if (specs.empty())
+            specs.assign(begin(WORKLOAD_SUITE), end(WORKLOAD_SUITE));
+        return benchWorkloads(specs, cache_config, engine);
+    }
+
+    LogMode logMode = do_stats ? LOG_NONE : do_buffered_log ? LOG_BUFFERED : LOG_COUT;
+    if (!sweep_specs.empty() && !arg_error && !do_help) {
+        if (!setupSweep(sweepSet, sweep_specs)) {
+            cerr << "Invalid sweep config" << endl;
+            return 1;
+        }
+        cs.sweep = &sweepSet;
+    }
+    if (stack_blocksize)
+        cs.capture = &captured;
+    // a checkpoint carries the operation counts, so a later --timing restore sees the whole run
+    if (do_timing || checkpoint_file || restore_file)
+        cs.timing = &timing;
+
+    /*replay a recorded trace through the caches instead of running a program*/
+    if (replay_trace && !arg_error && !do_help && filename == nullptr && !record_trace) {
+        configurecache(cs, cache_config);
+        setLatencies(cs.caches, timing);
+        setlogmode(cs, logMode, &logBuf);
+        if (do_classify)
+            startClassify(cs);
+        if (profile_top || profile_out)
+            startProfile(cs);
+        auto start = chrono::steady_clock::now();
+        long long replayed = replayTrace(cs, replay_trace);
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        logBuf.flush();
+        if (replayed < 0) {
+            cerr << "Can't read trace "<<replay_trace<<endl;
+            return 1;
+        }
+        if (do_stats)
+            print_all_cache_stats(cs);
+        if (do_timing)
+            print_timing(cs, 0, cout, replayed);
+        if (profile_top)
+            print_profile(cs, profile_top);
+        if (profile_out && !dumpProfile(cs, profile_out)) {
+            cerr << "Can't open file "<<profile_out<<endl;
+            return 1;
+        }
+        if (cs.sweep) {
+            runSweepBatch(sweepSet);
+            print_sweep_table(sweepSet);
+        }
+        if (stack_blocksize)
+            print_stack_distance(captured, stack_blocksize);
+        if (do_throughput)
+            cerr << "replay: " << replayed << " accesses in " << elapsed
+                 << " s, " << (uint64_t)(replayed / max(elapsed, 1e-9)) << " accesses/sec" << endl;
+        return 0;
+    }
+
+    /* Display error message if appropriate */
+    if (arg_error || do_help || (filename == nullptr && !restore_file) || replay_trace) {
+        cerr << "usage " << argv[0] << " [-h] [--cache CACHE] [--bench-cache] [--engine=ENGINE] [--print-state] [--throughput] [--stats] [--3c] [--timing[=SPEC]] [--profile[=N]] [--profile-out FILE] [--fast-forward N] [--warmup M] [--detail K] [--sample-interval I] [--checkpoint-at N FILE] [--buffered-log] [--record-trace FILE] [--sweep SWEEP] [--stack-distance BLOCKSIZE] [--raw] [--save-image FILE] filename" << endl;
+        cerr << "       " << argv[0] << " --restore FILE [--cache CACHE] [--engine=ENGINE] [--print-state] [--throughput] [--stats] [--timing[=SPEC]] [--profile[=N]] [--profile-out FILE] [--checkpoint-at N FILE] [--buffered-log] [--record-trace FILE]" << endl;
+        cerr << "       " << argv[0] << " --cores N [--quantum Q] --cache CACHE [--engine=ENGINE] [--print-state] [--throughput] [--stats] [--buffered-log] program[@ADDR] ..." << endl;
+        cerr << "       " << argv[0] << " --generate SPEC | --generate-suite DIR" << endl;
+        cerr << "       " << argv[0] << " --bench-workloads [--cache CACHE] [--engine=ENGINE] [SPEC ...]" << endl;
+        cerr << "       " << argv[0] << " --batch [--jobs N] [--batch-output FILE] [--cache CACHE] [--engine=ENGINE] [--timing[=SPEC]] program|directory ..." << endl;
+        cerr << "       " << argv[0] << " --replay-trace FILE [--cache CACHE] [--stats] [--timing[=SPEC]] [--profile[=N]] [--profile-out FILE] [--buffered-log] [--sweep SWEEP] [--stack-distance BLOCKSIZE]" << endl << endl; 
+        cerr << "Simulate E20 cache" << endl << endl;
+        cerr << "positional arguments:" << endl;
+        cerr << "  filename    The file containing machine code, typically with .bin suffix," << endl;
+        cerr << "              or a raw image written by --save-image" << endl<<endl;
+        cerr << "optional arguments:"<<endl;
+        cerr << "  -h, --help  show this help message and exit"<<endl;
+        cerr << "  --cache CACHE  Cache configuration: size,associativity,blocksize (for one"<<endl;
+        cerr << "                 cache) or"<<endl;
+        cerr << "                 size,associativity,blocksize,size,associativity,blocksize"<<endl;
+        cerr << "                 (for two caches), and so on for any number of levels."<<endl;
+        cerr << "                 A level's numbers may be followed by"<<endl;
+        cerr << "                 its replacement policy: legacy (default), lru, fifo,"<<endl;
+        cerr << "                 random, plru or srrip, e.g. 64,4,2,lru,256,8,2,srrip,"<<endl;
+        cerr << "                 and its write policy: wt (default) or wb, wa (default)"<<endl;
+        cerr << "                 or nwa, a prefetcher: nextline, stride or stream, and"<<endl;
+        cerr << "                 below L1, how it relates to the levels above: nine"<<endl;
+        cerr << "                 (default), incl or excl"<<endl;
+        cerr << "  --bench-cache  Time the original model, the general lookup and the"<<endl;
+        cerr << "                 specialized kernel for a range of geometries, and the hit"<<endl;
+        cerr << "                 rate and cost of each replacement policy, then exit"<<endl;
+        cerr << "  --generate SPEC  Print a synthetic program for an access pattern:"<<endl;
+        cerr << "                 stride, sweep, gather, chase or tile, optionally followed"<<endl;
+        cerr << "                 by :key=value,..., e.g. stride:stride=8,count=512,reps=4"<<endl;
+        cerr << "  --generate-suite DIR  Write the built-in workload suite to DIR as .bin"<<endl;
+        cerr << "                 files"<<endl;
+        cerr << "  --bench-workloads  Run each SPEC given (default: the built-in suite)"<<endl;
+        cerr << "                 through --cache and report instructions, accesses, best"<<endl;
+        cerr << "                 wall time of 3, throughput and peak RSS, then exit"<<endl;
+        cerr << "  --engine=ENGINE  Interpreter: switch (reference, default), threaded or"<<endl;
+        cerr << "                 block (translated basic blocks)"<<endl;
+        cerr << "  --print-state  Print the final pc, registers and memory at halt"<<endl;
+        cerr << "  --throughput   Report instructions/sec on stderr at halt"<<endl;
+        cerr << "  --stats        No per-access log; print hit/miss/eviction counters and"<<endl;
+        cerr << "                 traffic to the level below per cache level at halt"<<endl;
+        cerr << "  --3c           With --stats, split each level's misses into compulsory,"<<endl;
+        cerr << "                 capacity, conflict and invalidation misses"<<endl;
+        cerr << "  --timing[=SPEC]  Print cycles, CPI, AMAT and the stall cycles of each"<<endl;
+        cerr << "                 level at halt. SPEC sets cycles as name=N,...: l1, l2,"<<endl;
+        cerr << "                 l3, ... and mem latencies (default 1, 10, 40, 100) and"<<endl;
+        cerr << "                 the execute cost"<<endl;
+        cerr << "                 of any operation, e.g. lw=2,jeq=2 (default 1 each)"<<endl;
+        cerr << "  --fast-forward N  Run the first N instructions without the caches"<<endl;
+        cerr << "  --warmup M     Before each detailed sample, run M instructions through"<<endl;
+        cerr << "                 the caches without logging or counting them"<<endl;
+        cerr << "  --detail K     Simulate K instructions per sample in detail (default: to"<<endl;
+        cerr << "                 halt); --stats and --timing then cover these only, and a"<<endl;
+        cerr << "                 sampling summary with whole-run estimates is printed"<<endl;
+        cerr << "  --sample-interval I  Start a sample every I instructions, fast-forwarding"<<endl;
+        cerr << "                 between them (default: one sample, then fast-forward)"<<endl;
+        cerr << "  --checkpoint-at N FILE  Stop after N instructions and save the machine and"<<endl;
+        cerr << "                 every cache's contents and counters to FILE"<<endl;
+        cerr << "  --restore FILE Continue from a checkpoint instead of loading a program;"<<endl;
+        cerr << "                 --cache, if given, must be the one it was taken with"<<endl;
+        cerr << "  --profile[=N]  At halt, list for each level the N (default 10) pcs, ranges"<<endl;
+        cerr << "                 of 64 addresses and rows with the most misses"<<endl;
+        cerr << "  --profile-out FILE  Write every pc, range and row profile count to FILE,"<<endl;
+        cerr << "                 as JSON if FILE ends in .json, otherwise as CSV"<<endl;
+        cerr << "  --buffered-log Write the per-access log through a buffer instead of"<<endl;
+        cerr << "                 flushing every line"<<endl;
+        cerr << "  --record-trace FILE  Save every lw/sw (pc, address, store) to FILE in a"<<endl;
+        cerr << "                 compact binary format"<<endl;
+        cerr << "  --replay-trace FILE  Feed a recorded trace through the caches instead of"<<endl;
+        cerr << "                 running a program"<<endl;
+        cerr << "  --sweep SWEEP  Simulate many cache configurations in one run and print"<<endl;
+        cerr << "                 their hit rates. SWEEP is a ';' separated list of CACHE"<<endl;
+        cerr << "                 strings in which any field may list values separated by"<<endl;
+        cerr << "                 ':', e.g. 16:32:64,1:2:4,1:2 runs all 18 combinations"<<endl;
+        cerr << "  --stack-distance BLOCKSIZE  Print the LRU miss ratio of every power of two"<<endl;
+        cerr << "                 cache size and associativity for BLOCKSIZE, from one pass"<<endl;
+        cerr << "  --raw          filename is a headerless image of little-endian 16 bit words"<<endl;
+        cerr << "  --save-image FILE  Write the loaded program to FILE as a raw image, then exit"<<endl;
+        cerr << "  --cores N      Run N cores on one shared memory, each with a private L1"<<endl;
+        cerr << "                 kept coherent by MESI and the rest of CACHE shared. Give"<<endl;
+        cerr << "                 one program for every core or one per core; program@ADDR"<<endl;
+        cerr << "                 loads it at ADDR and starts its core there"<<endl;
+        cerr << "  --quantum Q    Instructions each core runs per turn with --cores (default 1)"<<endl;
+        cerr << "  --batch        Run every program given (a directory means its .bin files)"<<endl;
+        cerr << "                 in one process and print each one's instruction count,"<<endl;
+        cerr << "                 cache statistics and final state, in order"<<endl;
+        cerr << "  --jobs N       Worker threads for --batch (default 1)"<<endl;
+        cerr << "  --batch-output FILE  Write the --batch results to FILE instead of stdout"<<endl;
+        return 1;
+    }
+    /*resume from a checkpoint, with the caches it was taken with, or load the
+    machine code from the file*/
+    uint64_t restored = 0; // instructions executed before the checkpoint
+    MappedFile checkpoint;
+    if (restore_file) {
+        string saved_config;
+        if (!checkpoint.open(restore_file) || !checkpointConfig(checkpoint, saved_config)) {
+            cerr << "Can't read checkpoint "<<restore_file<<endl;
+            return 1;
+        }
+        if (!cache_config.empty() && cache_config != saved_config) {
+            cerr << "Checkpoint was taken with --cache " << saved_config << endl;
+            return 1;
+        }
+        cache_config = saved_config;
+    } else if (cores) {
+        multi.cores.assign(cores, Core());
+        if (!loadCorePrograms(*sim, multi, batch_paths, raw_image))
+            return 1;
+    } else {
+        size_t loaded = load_data_from_file(filename,sim->memory,sim->decoded,raw_image);
+        if (save_image) {
+            if (!save_raw_image(save_image, sim->memory, loaded)) {
+                cerr << "Can't open file "<<save_image<<endl;
+                return 1;
+            }
+            return 0;
+        }
+    }
+    
+    if (cores) {
+        // the private L1s and the coherence snoop model nine levels only
+        configurecache(cs, cache_config, false);
+        bool nine = !cs.caches.levels.empty() && cs.options[0].prefetcher == PREFETCH_NONE;
+        for (const LevelOptions &o : cs.options)
+            nine = nine && o.inclusion == INCL_NINE;
+        if (!nine) {
+            cerr << "--cores needs a --cache whose L1 has no prefetcher and whose levels are all nine" << endl;
+            return 1;
+        }
+    } else
+        configurecache(cs, cache_config);
+    setLatencies(cs.caches, timing);
+    setlogmode(cs, logMode, &logBuf);
+    if (cores)
+        setupCores(multi, cs);
+    if (do_classify)
+        startClassify(cs);
+    if (profile_top || profile_out)
+        startProfile(cs);
+    if (restore_file && !restoreCheckpoint(checkpoint, *sim, restored)) {
+        cerr << "Can't read checkpoint "<<restore_file<<endl;
+        return 1;
+    }
+    if (checkpoint_file && checkpoint_at <= restored) {
+        cerr << "--checkpoint-at " << checkpoint_at << " is not after the restored " << restored << " instructions" << endl;
+        return 1;
+    }
+    if (record_trace) {
+        if (!openTrace(traceWriter, record_trace)) {
+            cerr << "Can't open file "<<record_trace<<endl;
+            return 1;
+        }
+        cs.trace = &traceWriter;
+    }
+
+    auto start = chrono::steady_clock::now();
+    SampleStats sampled;
+    bool halted = true;
+    uint64_t executed;
+    if (plan.active())
+        executed = runSampled(*sim, engine, plan, sampled);
+    else if (cores)
+        executed = runCores(*sim, engine, multi, quantum);
+    else if (checkpoint_file) {
+        halted = false;
+        executed = runWindow(*sim, engine, RUN_LIMITED, cs.timing, checkpoint_at - restored, halted);
+    } else
+        executed = runSimulator(*sim, engine);
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    logBuf.flush();
+    if (record_trace)
+        flushTrace(traceWriter);
+    if (checkpoint_file) {
+        if (halted) {
+            cerr << "Program halted after " << restored + executed << " instructions, before --checkpoint-at" << endl;
+            return 1;
+        }
+        if (!saveCheckpoint(checkpoint_file, *sim, restored + executed)) {
+            cerr << "Can't open file "<<checkpoint_file<<endl;
+            return 1;
+        }
+    }
+
+    if (do_stats && cores)
+        for (const CacheLevel &c : multi.l1)
+            print_cache_stats(c, cs.caches.levels.empty() ? "memory" : cs.caches.levels[0].name);
+    if (do_stats)
+        print_all_cache_stats(cs);
+    if (cores)
+        print_cores(multi);
+    if (plan.active())
+        print_sampling(cs, sampled);
+    // sampled, the timing covers the detailed instructions only
+    if (do_timing)
+        print_timing(cs, plan.active() ? sampled.detailed : restored + executed);
+    if (profile_top)
+        print_profile(cs, profile_top);
+    if (profile_out && !dumpProfile(cs, profile_out)) {
+        cerr << "Can't open file "<<profile_out<<endl;
+        return 1;
+    }
+    if (cs.sweep) {
+        runSweepBatch(sweepSet);
+        print_sweep_table(sweepSet);
+    }
+    if (stack_blocksize)
+        print_stack_distance(captured, stack_blocksize);
+
+    // with --cores, each core's pc and registers, then the shared memory once
+    for (size_t i = 0; do_print_state && i < cores; i++) {
+        cout << "Core " << i << " ";
+        print_state(multi.cores[i].pc, multi.cores[i].reg, sim->memory, i + 1 == cores ? 128 : 0);
+    }
+    if (do_print_state && !cores)
+        print_state(sim->pc, sim->reg, sim->memory, 128);
+    if (do_throughput)
+        cerr << "engine " << engine << ": " << executed << " instructions in " << elapsed
+             << " s, " << (uint64_t)(executed / max(elapsed, 1e-9)) << " instructions/sec" << endl;
     return 0;
 }
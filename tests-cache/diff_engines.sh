@@ -0,0 +1,52 @@
+#!/bin/sh
+# Runs every program in this directory on each --engine under several cache
+# configurations and checks that the threaded and block engines print exactly
+# what the switch engine does: the per-access cache log and the final state.
+#
+#   g++ -O2 -Wall -o sim sim_cache.cpp
+#   tests-cache/diff_engines.sh ./sim
+#
+# Exits 1 if any run differs.
+
+SIM=${1:-./sim}
+DIR=$(dirname "$0")
+OUT=$(mktemp -d)
+trap 'rm -rf "$OUT"' EXIT
+
+CONFIGS="4,1,1
+16,2,2
+64,4,4,lru
+16,2,2,wb
+16,2,2,wb,nwa
+8,2,2,64,4,4
+8,2,2,wb,64,4,4,wb
+8,1,2,wt,64,4,4,wb,fifo
+8,2,2,nextline,64,8,2,incl
+8,2,2,wb,32,4,2,wb,excl"
+
+status=0
+count=0
+for prog in "$DIR"/*.bin; do
+    for config in $CONFIGS; do
+        for engine in switch threaded block; do
+            "$SIM" --engine=$engine --cache "$config" --print-state "$prog" > "$OUT/$engine" 2>&1
+            rc=$?
+            if [ $rc -ne 0 ]; then
+                echo "FAIL $prog --cache $config --engine=$engine: exit status $rc"
+                status=1
+            fi
+        done
+        for engine in threaded block; do
+            if ! cmp -s "$OUT/switch" "$OUT/$engine"; then
+                echo "DIFF $prog --cache $config: --engine=$engine differs from --engine=switch"
+                status=1
+            fi
+        done
+        count=$((count + 1))
+    done
+done
+
+if [ $status -eq 0 ]; then
+    echo "$count program/configuration pairs identical on all engines"
+fi
+exit $status